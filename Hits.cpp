@@ -10,64 +10,84 @@
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void
-Hit::print( std::ostream & out ) const
+Hit::print( std::vector< std::string > const & genenames, std::ostream & out ) const
 {
 	out << std::showpoint << std::fixed << std::setprecision(2) << score_
-	    << " " << sequence_ << " " << source_ << " " << seqindex_;
+	    << " " << genenames[ geneindex_ ] << " " << seqindex_;
 	if ( rvs_ ) out << " (rvs)";
 	out << std::endl;
 }
 
-std::ostream & operator << ( std::ostream & out, Hit const & hit )
+bool besthitfirst( Hit const & h1, Hit const & h2 )
 {
-	hit.print( out );
-	return out;
+	if ( h1.score() != h2.score() ) return h1.score() < h2.score();
+	if ( h1.geneindex() != h2.geneindex() ) return h1.geneindex() < h2.geneindex();
+	if ( h1.seqindex() != h2.seqindex() ) return h1.seqindex() < h2.seqindex();
+	return !h1.rvs() && h2.rvs();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void
 HitManager::add_hit(
 	float score,
-	std::vector< char > const & hitseq,
-	std::string const & name,
-	unsigned seqindex,
+	unsigned geneindex,
+	uint64_t seqindex,
 	bool rvs
 )
 {
-
-	std::list< Hit >::iterator insert_itr( hits_.end() );
-	// first hit, or better than current best
-	if ( hits_.size() == 0 || score < hits_.back().score() ) insert_itr = hits_.end();
-	// in between: insert in proper order
-	else {
-	// this could be made MUCH faster for large lists, as a binary search that assumes strict ordering
-	// dilemma: list is constant insert time, but no direct access to elements (must traverse list)
-		for ( std::list< Hit >::iterator hit_itr( hits_.begin() );
-		      hit_itr != hits_.end(); ++hit_itr ) {
-			// found the first superior hit_itr, insert before it
-			if ( score >= hit_itr->score() ) { insert_itr = hit_itr; break; }
-		}
+	if ( score > maxscore_ ) return;
+	// cheap rejection before building the hit (ties are settled by insert)
+	if ( hits_.size() >= maxhits_ && !hits_.empty() && score > worst() ) {
+		full_ = true;
+		return;
 	}
 
-	if ( !rvs ) {
-		hits_.insert( insert_itr, Hit( hitseq, score, name, seqindex ) );
-	} else {
-		std::vector<char> rvsseq( hitseq );
-		std::reverse( rvsseq.begin(), rvsseq.end() );
-		std::transform( rvsseq.begin(), rvsseq.end(), rvsseq.begin(), comp );
-		hits_.insert( insert_itr, Hit( rvsseq, score, name, seqindex, true ) );
+	insert( Hit( score, geneindex, seqindex, rvs ) );
+}
+
+//// bounded heap insertion: O(log maxhits), the worst hit is dropped once there are too many
+void
+HitManager::insert( Hit const & hit )
+{
+	if ( hits_.size() < maxhits_ ) {
+		hits_.push_back( hit );
+		std::push_heap( hits_.begin(), hits_.end(), besthitfirst );
+		return;
 	}
+	full_ = true;
+	if ( hits_.empty() || !besthitfirst( hit, hits_.front() ) ) return;
+	std::pop_heap( hits_.begin(), hits_.end(), besthitfirst );
+	hits_.back() = hit;
+	std::push_heap( hits_.begin(), hits_.end(), besthitfirst );
+}
 
-	if ( hits_.size() > maxhits_ ) {
-		full_ = true;
-		hits_.pop_front();
+//// keeps the best maxhits of both lists; the result does not depend on how the search was divided
+void
+HitManager::merge( HitManager const & other )
+{
+	for ( std::vector< Hit >::const_iterator h( other.hits_.begin() ), e( other.hits_.end() ); h != e; ++h ) {
+		insert( *h );
 	}
+	full_ = full_ || other.full_;
+}
+
+//// the only place the hits are sorted
+std::vector< Hit >
+HitManager::hits() const
+{
+	std::vector< Hit > sorted( hits_ );
+	std::sort_heap( sorted.begin(), sorted.end(), besthitfirst );
+	// worst first
+	std::reverse( sorted.begin(), sorted.end() );
+	return sorted;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void
-HitManager::print( std::ostream & out ) const
+HitManager::print( std::vector< std::string > const & genenames, std::ostream & out ) const
 {
-	for ( std::list< Hit >::const_iterator h( hits_.begin() ), e( hits_.end() ); h != e; ++h ) out << *h;
+	std::vector< Hit > const sorted( hits() );
+	for ( std::vector< Hit >::const_iterator h( sorted.begin() ), e( sorted.end() ); h != e; ++h ) {
+		h->print( genenames, out );
+	}
 }
-
@@ -5,86 +5,172 @@
 #ifndef INCLUDED_Hits
 #define INCLUDED_Hits
 
+#include <algorithm> // std::min
+#include <atomic>
+#include <functional> // std::function
 #include <iostream>
-#include <list>
+#include <limits>
+#include <stdint.h> // uint64_t
+#include <string>
 #include <vector>
 
 #include "util.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
+/// compact record of a hit: the site and gene name are looked up again only for output
 class Hit {
 
 	public:
 		Hit()
 			: score_( 0.0 ),
-				source_( "" ),
+				geneindex_( 0 ),
 				seqindex_( 0 ),
 				rvs_( false )
 		{}
 
 		Hit(
-			std::vector< char > const & _sequence,
 			float _score,
-			std::string const & _source,
-			unsigned _seqindex,
+			unsigned _geneindex,
+			uint64_t _seqindex,
 			bool _rvs = false
 		)
-			: sequence_( _sequence ),
-				score_( _score ),
-				source_( _source ),
+			: score_( _score ),
+				geneindex_( _geneindex ),
 				seqindex_( _seqindex ),
 				rvs_( _rvs )
 		{}
 
-		std::vector< char > const & sequence() const { return sequence_; }
 		float score() const { return score_; }
-		std::string const & source() const { return source_; }
-		unsigned seqindex() const { return seqindex_; }
+		unsigned geneindex() const { return geneindex_; }
+		uint64_t seqindex() const { return seqindex_; }
 		bool rvs() const { return rvs_; }
 
-		void print( std::ostream & out = std::cout ) const;
+		// genenames: names of the genes by index, as kept by the search that found the hit
+		void print( std::vector< std::string > const & genenames, std::ostream & out = std::cout ) const;
 
 	private:
-		std::vector< char > sequence_;
 		float score_;
-		std::string source_;
-		unsigned seqindex_;
+		unsigned geneindex_; // order of the gene among all sequences searched (TargetSearch keeps to 32 bits)
+		uint64_t seqindex_;
 		bool rvs_;
 };
 
-std::ostream & operator << ( std::ostream & out, Hit const & hit );
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// receives the results of a search one hit at a time, in place of printed output
+class HitSink {
+
+	public:
+		virtual ~HitSink() {}
+
+		// hit of matrix on gene at position (the start of the window on the forward strand), with the
+		// site read along the strand of the hit
+		virtual void hit( std::string const & matrix, std::string const & gene, uint64_t position,
+		                  bool rvs, float score, std::string const & site ) = 0;
+};
+
+/// a HitSink calling a function (or lambda) for each hit
+class CallbackSink : public HitSink {
+
+	public:
+		typedef std::function< void ( std::string const & matrix, std::string const & gene, uint64_t position,
+		                              bool rvs, float score, std::string const & site ) > Callback;
+
+		CallbackSink( Callback const & callback ) : callback_( callback ) {}
+
+		void hit( std::string const & matrix, std::string const & gene, uint64_t position,
+		          bool rvs, float score, std::string const & site )
+		{
+			callback_( matrix, gene, position, rvs, score, site );
+		}
+
+	private:
+		Callback callback_;
+};
+
+// ranking of hits: best (lowest) score first, ties going to the hit found first in a serial search
+// (earlier gene, then earlier position, then forward before reverse strand)
+bool besthitfirst( Hit const & h1, Hit const & h2 );
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 class HitManager {
 
 	public:
-		HitManager() : full_(false), maxhits_(0), outputlevel_(NORMAL) {}
+		HitManager()
+			: full_(false),
+				maxhits_(0),
+				maxscore_( std::numeric_limits< float >::infinity() ),
+				outputlevel_(NORMAL)
+		{}
 
 		void full( bool value ) { full_ = value; }
 		void maxhits( unsigned value ) { maxhits_ = value; }
+		// fixed score threshold: hits scoring above it are never kept
+		void maxscore( float value ) { maxscore_ = value; }
+		// tighten the threshold to a score already reached by maxhits hits (ties may still win)
+		void bound( float value ) { maxscore_ = std::min( maxscore_, value ); }
 		void outputlevel( OutputLevel level ) { outputlevel_ = level; }
 
-		std::list< Hit > const & hits() const { return hits_; }
+		// hits ranked worst first (sorted on demand: the list is kept as a heap)
+		std::vector< Hit > hits() const;
 		bool full() const { return full_; }
 		unsigned maxhits() const { return maxhits_; }
+		float maxscore() const { return maxscore_; }
 
 		void
 		add_hit(
 			float score,
-			std::vector< char > const & hitseq,
-			std::string const & name,
-			unsigned seqindex,
+			unsigned geneindex,
+			uint64_t seqindex,
 			bool rvs = false
 		);
 
-		float worst() const { return hits_.front().score(); }
-		void print( std::ostream & out = std::cout ) const;
+		// combine with hits found independently elsewhere (e.g. another part of the sequence)
+		void merge( HitManager const & other );
+
+		// score of the worst hit kept (the heap top)
+		float worst() const
+		{
+			return hits_.empty() ? std::numeric_limits< float >::infinity() : hits_.front().score();
+		}
+		// no window scoring above this can be kept (lower scores may still lose ties once full)
+		float cutoff() const { return full_ ? std::min( maxscore_, worst() ) : maxscore_; }
+		// basic output of the hits, worst first as hits() ranks them (without their sites)
+		void print( std::vector< std::string > const & genenames, std::ostream & out = std::cout ) const;
+
+	private:
+		void insert( Hit const & hit );
 
 	private:
-		std::list< Hit > hits_;
+		std::vector< Hit > hits_; // bounded max-heap under besthitfirst: worst hit on top
 		bool full_;
 		unsigned maxhits_;
+		float maxscore_;
 		OutputLevel outputlevel_;
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// lock-free score cutoff shared by threads searching different parts of the input
+/// any thread whose own list is full publishes its worst score; since the final list can only be
+/// better than that, windows scoring above the shared value can be rejected everywhere
+/// (ties cannot: they may still win on position)
+class SharedCutoff {
+
+	public:
+		SharedCutoff() : value_( std::numeric_limits< float >::infinity() ) {}
+		SharedCutoff( float value ) : value_( value ) {}
+
+		float value() const { return value_.load( std::memory_order_relaxed ); }
+
+		// tighten the cutoff (never loosens it)
+		void lower( float value )
+		{
+			float current( value_.load( std::memory_order_relaxed ) );
+			while ( value < current &&
+			        !value_.compare_exchange_weak( current, value, std::memory_order_relaxed ) ) {}
+		}
+
+	private:
+		std::atomic< float > value_;
+};
+
 #endif
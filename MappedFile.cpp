@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm> // std::min, std::max
+#include <atomic>
+#include <cstring> // memset
+#include <fcntl.h> // open
+#include <stdint.h> // uint32_t
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h> // read, close
+#include <zlib.h>
+
+#include "MappedFile.h"
+#include "TaskScheduler.h"
+
+MappedFile::MappedFile(
+	std::string const & filename,
+	unsigned threads // = 1
+)
+	: data_(0),
+		size_(0),
+		mapped_(false),
+		good_(false)
+{
+	int const fd( filename == "-" ? 0 : open( filename.c_str(), O_RDONLY ) );
+	if ( fd < 0 ) return;
+	good_ = true;
+
+	struct stat info;
+	if ( fstat( fd, &info ) == 0 && S_ISREG( info.st_mode ) && info.st_size > 0 ) {
+		void * map( mmap( 0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) );
+		if ( map != MAP_FAILED ) {
+			madvise( map, info.st_size, MADV_SEQUENTIAL );
+			data_ = static_cast< char const * >( map );
+			size_ = info.st_size;
+			mapped_ = true;
+		}
+	}
+	if ( !mapped_ ) read_all( fd );
+	if ( fd != 0 ) close( fd );
+
+	unsigned char const * const bytes( reinterpret_cast< unsigned char const * >( data_ ) );
+	if ( size_ >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b ) {
+		good_ = gunzip( threads );
+		if ( !good_ ) release(); // (no compressed bytes passed off as text)
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	release();
+}
+
+void
+MappedFile::release()
+{
+	if ( mapped_ ) munmap( const_cast< char * >( data_ ), size_ );
+	mapped_ = false;
+	std::vector< char >().swap( buffer_ );
+	data_ = 0;
+	size_ = 0;
+}
+
+//// fallback for streams
+void
+MappedFile::read_all( int fd )
+{
+	size_t const chunk( 1 << 20 );
+	size_t used(0);
+	while ( true ) {
+		buffer_.resize( used + chunk );
+		ssize_t const got( read( fd, &buffer_[used], chunk ) );
+		if ( got <= 0 ) break;
+		used += got;
+	}
+	buffer_.resize( used );
+	data_ = buffer_.empty() ? 0 : &buffer_[0];
+	size_ = used;
+}
+
+static uint32_t
+little32( unsigned char const * p )
+{
+	return uint32_t( p[0] ) | uint32_t( p[1] ) << 8 | uint32_t( p[2] ) << 16 | uint32_t( p[3] ) << 24;
+}
+
+//// gzip members one after another (such as BGZF blocks that gunzip_blocks could not take)
+bool
+MappedFile::gunzip( unsigned threads )
+{
+	// (no member is shorter than its 10-byte header and 8-byte trailer)
+	if ( size_ < 18 ) return false;
+	if ( gunzip_blocks( threads ) ) return true;
+
+	unsigned char const * const in( reinterpret_cast< unsigned char const * >( data_ ) );
+	size_t const maxchunk( 1 << 30 ); // (zlib counts in 32 bits)
+	// the trailer of the last member holds its size (modulo 4 GB): a good first guess
+	std::vector< char > text( std::max< size_t >( 1 << 20, little32( in + size_ - 4 ) ) );
+	z_stream z;
+	memset( &z, 0, sizeof( z ) );
+	if ( inflateInit2( &z, 15 + 16 ) != Z_OK ) return false;
+	size_t consumed(0), used(0);
+	int status( Z_OK );
+	while ( true ) {
+		if ( used == text.size() ) text.resize( 2 * text.size() );
+		if ( z.avail_in == 0 ) {
+			z.next_in = const_cast< unsigned char * >( in + consumed );
+			z.avail_in = std::min( size_ - consumed, maxchunk );
+		}
+		z.next_out = reinterpret_cast< unsigned char * >( &text[ used ] );
+		z.avail_out = std::min( text.size() - used, maxchunk );
+		unsigned const availin( z.avail_in ), availout( z.avail_out );
+		status = inflate( &z, Z_NO_FLUSH );
+		consumed += availin - z.avail_in;
+		used += availout - z.avail_out;
+		if ( status == Z_STREAM_END ) {
+			// another member may follow (anything else is ignored, as by gzip)
+			if ( size_ - consumed < 2 || in[ consumed ] != 0x1f || in[ consumed + 1 ] != 0x8b ) break;
+			inflateReset( &z );
+			z.avail_in = 0;
+		} else if ( status != Z_OK && !( status == Z_BUF_ERROR && consumed < size_ ) ) break;
+	}
+	inflateEnd( &z );
+	if ( status != Z_STREAM_END ) return false;
+
+	text.resize( used );
+	release();
+	buffer_.swap( text );
+	data_ = buffer_.empty() ? 0 : &buffer_[0];
+	size_ = used;
+	return true;
+}
+
+//// BGZF blocks are gzip members of at most 64 kB, whose extra field gives their compressed size and
+//// whose trailer their decompressed size: every block's place in the text is known before any of
+//// them is decompressed, and runs of blocks are decompressed straight into place in parallel
+bool
+MappedFile::gunzip_blocks( unsigned threads )
+{
+	struct Block {
+		size_t in, insize, out, outsize;
+		uint32_t crc;
+	};
+	unsigned char const * const in( reinterpret_cast< unsigned char const * >( data_ ) );
+	std::vector< Block > blocks;
+	size_t total(0);
+	for ( size_t pos(0); pos < size_; ) {
+		// gzip header with only the extra field, whose first subfield is 'BC' (2 bytes: size - 1)
+		if ( size_ - pos < 26 || in[pos] != 0x1f || in[pos+1] != 0x8b || in[pos+2] != 8 || in[pos+3] != 4 ) return false;
+		unsigned const xlen( in[pos+10] | in[pos+11] << 8 );
+		if ( xlen < 6 || in[pos+12] != 'B' || in[pos+13] != 'C' || in[pos+14] != 2 || in[pos+15] != 0 ) return false;
+		size_t const blocksize( ( in[pos+16] | in[pos+17] << 8 ) + 1 ), header( 12 + xlen );
+		if ( blocksize < header + 8 || blocksize > size_ - pos ) return false;
+		Block const block = { pos + header, blocksize - header - 8, total, little32( in + pos + blocksize - 4 ),
+		                      little32( in + pos + blocksize - 8 ) };
+		blocks.push_back( block );
+		total += block.outsize;
+		pos += blocksize;
+	}
+
+	std::vector< char > text( total );
+	std::atomic< bool > good( true );
+	TaskScheduler scheduler( threads );
+	unsigned const taskblocks( 64 ); // about 4 MB of text
+	for ( size_t first(0); first < blocks.size(); first += taskblocks ) {
+		size_t const last( std::min< size_t >( blocks.size(), first + taskblocks ) );
+		scheduler.add( [&, first, last]( unsigned ) {
+			z_stream z;
+			memset( &z, 0, sizeof( z ) );
+			if ( inflateInit2( &z, -15 ) != Z_OK ) { // raw deflate data
+				good = false;
+				return;
+			}
+			for ( size_t b( first ); b < last && good; ++b ) {
+				Block const & block( blocks[b] );
+				if ( block.outsize == 0 ) continue; // (such as the end-of-file marker block)
+				unsigned char * const out( reinterpret_cast< unsigned char * >( &text[ block.out ] ) );
+				z.next_in = const_cast< unsigned char * >( in + block.in );
+				z.avail_in = block.insize;
+				z.next_out = out;
+				z.avail_out = block.outsize;
+				if ( inflate( &z, Z_FINISH ) != Z_STREAM_END || z.avail_out != 0 ||
+				     crc32( 0, out, block.outsize ) != block.crc ) good = false;
+				inflateReset( &z );
+			}
+			inflateEnd( &z );
+		}, last - first );
+	}
+	scheduler.run();
+	if ( !good ) return false;
+
+	release();
+	buffer_.swap( text );
+	data_ = buffer_.empty() ? 0 : &buffer_[0];
+	size_ = total;
+	return true;
+}
@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_MappedFile
+#define INCLUDED_MappedFile
+
+#include <cstddef> // size_t
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// read-only view of the full contents of a file
+/// regular files are memory-mapped; anything that cannot be mapped (pipes, "-" for stdin) is read
+/// into memory instead
+/// gzip files are decompressed into memory; those made of BGZF blocks (as written by bgzip) are
+/// decompressed by threads threads, block by block
+class MappedFile {
+
+	public:
+		MappedFile( std::string const & filename, unsigned threads = 1 );
+		~MappedFile();
+
+		bool good() const { return good_; }
+		char const * data() const { return data_; }
+		size_t size() const { return size_; }
+
+	private:
+		// not copyable
+		MappedFile( MappedFile const & );
+		MappedFile & operator = ( MappedFile const & );
+
+		void read_all( int fd );
+		// replace the contents by their decompressed text (false if they are not valid gzip)
+		bool gunzip( unsigned threads );
+		bool gunzip_blocks( unsigned threads );
+		// unmap or free the contents, leaving the file empty
+		void release();
+
+	private:
+		char const * data_;
+		size_t size_;
+		bool mapped_, good_;
+		std::vector< char > buffer_; // contents of unmappable files
+};
+
+#endif
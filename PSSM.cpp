@@ -4,11 +4,11 @@
 
 #include <fstream>
 #include <iostream>
-#include <math.h> // fabs
+#include <math.h> // fabs, floor
 #include <sstream>
 #include <vector>
-#include <cstdlib> // exit, EXIT_FAILURE
-#include <algorithm> // std::sort
+#include <algorithm> // std::sort, std::min, std::max, std::fill
+#include <limits>
 
 #include "PSSM.h"
 #include "util.h"
@@ -67,7 +67,10 @@ std::ostream & operator << ( std::ostream & out, PssmPos const & pssm_pos )
 ////////////////////////////////////////////////////////////////////////////////
 //// the full PS matrix
 
-void
+// (defined here as well: std::min takes it by reference)
+unsigned const PSSM::blocklength;
+
+bool
 PSSM::setup(
 	std::string const & filename,
 	bool invert,
@@ -75,12 +78,16 @@ PSSM::setup(
 )
 {
 	outputlevel_ = level;
-	readfile( filename, invert );
+	return readfile( filename, invert );
 }
 
-void
-PSSM::setup(std::string const & target)
+bool
+PSSM::setup(
+	std::string const & target,
+	OutputLevel level // = NORMAL
+)
 {
+	outputlevel_ = level;
 	int siteindex(0);
 	std::list<char> const nucs( nucleotides() );
 
@@ -91,7 +98,8 @@ PSSM::setup(std::string const & target)
 	for(std::string::const_iterator it(target.begin()); it!=target.end(); ++it){
 		PssmPos new_pssm_pos(siteindex);
 		// all of the nucs specified by code letter
-		std::list<char> const deg( degen(*it) );
+		std::list<char> const deg( degen( upper(*it) ) );
+		if ( deg.empty() ) return fail( std::string( "unrecognized letter " ) + *it + " in target " + target );
 		// check each of the key_ nucs for representation in deg
 		for(std::vector<char>::const_iterator k(key_.begin()); k!=key_.end(); ++k){
 			float weight(0);
@@ -105,6 +113,17 @@ PSSM::setup(std::string const & target)
 	length_ = positions_.size();
 
 	set_priority_and_best_cases();
+	build_tables();
+	build_blocks();
+	return true;
+}
+
+bool
+PSSM::fail( std::string const & error )
+{
+	error_ = error;
+	if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: " << error << std::endl;
+	return false;
 }
 
 void
@@ -121,41 +140,29 @@ PSSM::print(
   pssm_pos != positions_.end(); ++pssm_pos ) { out << *pssm_pos << std::endl; }
 }
 
-float
-PSSM::score(
-	int siteindex,
-	char letter
-) const
-{
-//	std::cout << "DEBUG: letter=" << letter << std::endl;
-	for ( unsigned i(0); i < key_.size(); ++i ) {
-		if ( letter == key_[i] ) {
-			return positions_[ siteindex ].weights()[i];
-		}
-	}
-	// this will be triggered by any non-true nucleotide, such as 'N'--no score assessed for these
-//	std::cerr << "ERROR: score failed for unknown character (" << letter << ") at " << siteindex << std::endl;
-//	exit(EXIT_FAILURE);
-	return 0;
-}
-
-void
+bool
 PSSM::parse_key( std::string const & line )
 {
 	std::istringstream linestream( line );
 	std::string dummy;
 	linestream >> dummy; // "key"
 	char letter;
-	while ( linestream >> letter ) key_.push_back( upper( letter ) );
+	while ( linestream >> letter ) {
+		char const code( upper( letter ) );
+		if ( !code ) return fail( std::string( "unrecognized letter " ) + letter + " in PSSM key" );
+		key_.push_back( code );
+	}
 	if(outputlevel_ > NORMAL){
 		std::cout << "key:" << std::endl;
 		for(std::vector<char>::const_iterator k(key_.begin()); k!=key_.end(); ++k){
 			std::cout << *k << std::endl;
 		}
 	}
+	return true;
 }
 
-void
+//// problems are reported to the caller rather than ending the program (which may be a server)
+bool
 PSSM::readfile(
 	std::string const & filename,
 	bool invert
@@ -164,18 +171,17 @@ PSSM::readfile(
 	// open input file
 	std::ifstream file;
 	file.open( filename.c_str() );
-	if ( !file ) {
-		std::cerr << "ERROR: unable to open PSSM file " << filename.c_str() << std::endl;
-		exit(EXIT_FAILURE);
-	}
+	if ( !file ) return fail( "unable to open PSSM file " + filename );
 	if ( outputlevel_ >= NORMAL ) std::cout << "Reading PSSM file " << filename << std::endl;
 
 	// read input file
 	std::string line;
 	while ( getline( file, line ) ) {
 		if ( line[0] == '#' ) continue;
-		if ( line.substr(0,3) == "key" || line.substr(0,3) == "KEY" ) parse_key( line );
-		else {
+		if ( line.substr(0,3) == "key" || line.substr(0,3) == "KEY" ) {
+			if ( !parse_key( line ) ) return false;
+		} else {
+			if ( key_.empty() ) return fail( "weights given before key in " + filename );
 			std::istringstream linestream( line );
 			int siteindex;
 			linestream >> siteindex;
@@ -183,21 +189,22 @@ PSSM::readfile(
 			float weight;
 			while ( linestream >> weight ) {
 				if ( new_pssm_pos.weights().size() == key_.size() ) {
-					std::cerr << "Error: more weights given for " << siteindex
-					          << " than denoted in key!" << std::endl;
-					exit(EXIT_FAILURE);
+					std::ostringstream error;
+					error << "more weights given for " << siteindex << " than denoted in key in " << filename;
+					return fail( error.str() );
 				}
 				new_pssm_pos.add_weight( weight );
 			}
 			if ( new_pssm_pos.weights().size() < key_.size() ) {
-				std::cerr << "Error: less weights given for " << siteindex
-				          << " than denoted in key!" << std::endl;
-				exit(EXIT_FAILURE);
+				std::ostringstream error;
+				error << "less weights given for " << siteindex << " than denoted in key in " << filename;
+				return fail( error.str() );
 			}
 			positions_.push_back( new_pssm_pos );
 		}
 	}
 	length_ = positions_.size();
+	if ( length_ == 0 ) return fail( "no weights in PSSM file " + filename );
 
 	if ( invert ) {
 		for ( std::vector< PssmPos >::iterator pssm_pos( positions_.begin() );
@@ -205,6 +212,9 @@ PSSM::readfile(
 	}
 	if ( outputlevel_ >= MINIMAL ) print();
 	set_priority_and_best_cases();
+	build_tables();
+	build_blocks();
+	return true;
 }
 
 //// this sets up fairly important optimizations of the naive approach
@@ -256,6 +266,216 @@ PSSM::set_priority_and_best_cases()
 
 }
 
+//// dense per-position lookup tables indexed by raw sequence byte, so that scoring is a single load
+//// per base with no search over the key, for either strand
+void
+PSSM::build_tables()
+{
+	table_.assign( length_ << 8, 0. );
+	rctable_.assign( length_ << 8, 0. );
+
+	for ( unsigned i(0); i < length_; ++i ) {
+		std::vector< float > const & weights( positions_[i].weights() );
+		// any non-key letter, such as 'N', is not scored
+		// earlier key entries take precedence over later duplicates
+		for ( unsigned k( key_.size() ); k > 0; --k ) {
+			char const letter( key_[k-1] );
+			float const weight( weights[k-1] );
+			table_[ ( i << 8 ) + (unsigned char)letter ] = weight;
+			table_[ ( i << 8 ) + (unsigned char)lower( letter ) ] = weight;
+		}
+	}
+
+	char const bases[] = { 'A', 'C', 'G', 'T' };
+	consensus_.assign( length_, 0 );
+	for ( unsigned i(0); i < length_; ++i ) {
+		if ( table_[ ( i << 8 ) + 'N' ] != 0 ) consensus_[i] = -1;
+		for ( unsigned b(0); b < 4 && consensus_[i] >= 0; ++b ) {
+			float const weight( table_[ ( i << 8 ) + bases[b] ] );
+			if ( weight == -1 ) consensus_[i] |= 1 << b;
+			else if ( weight != 0 ) consensus_[i] = -1;
+		}
+	}
+
+	// reverse complement: rc position j reads the complement of the base at matrix position length-j-1
+	for ( unsigned j(0); j < length_; ++j ) {
+		unsigned const i( length_ - j - 1 );
+		for ( unsigned b(0); b < 256; ++b ) {
+			char const letter( b );
+			if ( !isnuc( letter ) ) continue;
+			rctable_[ ( j << 8 ) + b ] = table_[ ( i << 8 ) + (unsigned char)comp( upper( letter ) ) ];
+		}
+	}
+}
+
+//// lookahead tables for scoring several adjacent positions at once, so that most windows are
+//// rejected after a few lookups; the bound after each block is the best sum over the blocks left
+void
+PSSM::build_blocks()
+{
+	blocks_ = make_blocks( table_ );
+	rcblocks_ = make_blocks( rctable_ );
+
+	if ( outputlevel_ >= VERBOSE ) {
+		std::cout << "\nPSSM block tables (offset, length, best additional score):\n";
+		for ( unsigned i(0); i < blocks_.size(); ++i ) {
+			std::cout << blocks_[i].offset << " " << blocks_[i].length << " " << blocks_[i].bestcase << '\n';
+		}
+		std::cout << std::endl;
+	}
+}
+
+std::vector< PssmBlock >
+PSSM::make_blocks( std::vector< float > const & table ) const
+{
+	char const letters[] = { 'A', 'C', 'G', 'T' };
+
+	// the cut that isolates the most variable block is kept (the first block is the one that
+	// rejects most windows)
+	std::vector< PssmBlock > blocks;
+	float bestrange(-1.);
+	for ( unsigned phase(0); phase < std::min( blocklength, length_ ); ++phase ) {
+		std::vector< PssmBlock > cut;
+		std::vector< std::pair< unsigned, float > > ranges;
+		for ( unsigned offset(0); offset < length_; ) {
+			PssmBlock block;
+			block.offset = offset;
+			block.length = std::min( offset == 0 && phase ? phase : blocklength, length_ - offset );
+			block.weights.assign( 1 << ( 2 * block.length ), 0. );
+			for ( unsigned index(0); index < block.weights.size(); ++index ) {
+				for ( unsigned j(0); j < block.length; ++j ) {
+					char const letter( letters[ ( index >> ( 2*j ) ) & 3 ] );
+					block.weights[index] += table[ ( ( offset + j ) << 8 ) + (unsigned char)letter ];
+				}
+			}
+			float const best( *std::min_element( block.weights.begin(), block.weights.end() ) );
+			float const worst( *std::max_element( block.weights.begin(), block.weights.end() ) );
+			ranges.push_back( std::pair< unsigned, float >( cut.size(), worst - best ) );
+			block.bestcase = best; // for now
+			cut.push_back( block );
+			offset += block.length;
+		}
+		std::sort( ranges.begin(), ranges.end(), secondfloatdesc );
+		if ( ranges[0].second <= bestrange ) continue;
+		bestrange = ranges[0].second;
+
+		// priority order by range, as for single positions
+		blocks.clear();
+		for ( unsigned i(0); i < ranges.size(); ++i ) blocks.push_back( cut[ ranges[i].first ] );
+		float bestcase(0.);
+		for ( unsigned i( blocks.size() ); i > 0; --i ) {
+			float const best( blocks[i-1].bestcase );
+			blocks[i-1].bestcase = bestcase;
+			bestcase += best;
+		}
+	}
+	return blocks;
+}
+
+//// (the reverse-complemented matrix has the mirror image run, at length_ - offset - length)
+unsigned
+PSSM::seed_offset( unsigned length ) const
+{
+	std::vector< unsigned > rank( length_ );
+	for ( unsigned i(0); i < length_; ++i ) rank[ priority_[i] ] = i;
+	unsigned best(0), bestsum( std::numeric_limits< unsigned >::max() );
+	for ( unsigned offset(0); offset + length <= length_; ++offset ) {
+		unsigned sum(0);
+		for ( unsigned i( offset ); i < offset + length; ++i ) sum += rank[i];
+		if ( sum < bestsum ) { best = offset; bestsum = sum; }
+	}
+	return best;
+}
+
+//// the dynamic programming over positions sums weights on a grid of at most maxbins scores
+//// weights that are integers once scaled by a power of ten (as written in matrix files) and span few
+//// enough scores are summed exactly, on the grid of that scale; others are rounded down to a grid
+//// of maxbins steps over the whole score range, so that no window scores above (worse than) its
+//// real score on the grid: every window passing the cutoff also passes it on the grid, where those
+//// that do are at most a fraction pvalue of random sites (the cutoff errs towards fewer hits)
+float
+PSSM::pvalue_cutoff(
+	double pvalue,
+	std::vector< double > const & background
+) const
+{
+	char const letters[] = { 'A', 'C', 'G', 'T' };
+	unsigned const maxbins( 1 << 17 );
+
+	double range(0.); // of total scores
+	for ( unsigned i(0); i < length_; ++i ) range += positions_[i].worstweight() - positions_[i].bestweight();
+
+	double step(0.); // grid spacing (0: none found yet)
+	double scale(1.);
+	for ( unsigned digits(0); digits < 6 && step == 0.; ++digits, scale *= 10 ) {
+		if ( range * scale >= maxbins ) break;
+		bool integral( true );
+		for ( unsigned i(0); i < length_ && integral; ++i ) {
+			for ( unsigned c(0); c < 4; ++c ) {
+				double const scaled( score( i, letters[c] ) * scale );
+				if ( fabs( scaled - floor( scaled + 0.5 ) ) > 1e-3 ) { integral = false; break; }
+			}
+		}
+		if ( integral ) step = 1. / scale;
+	}
+	bool const exact( step > 0. );
+	if ( !exact ) step = range > 0. ? range / ( maxbins - length_ ) : 1.;
+
+	// grid index of each weight, relative to the best weight of its position
+	std::vector< long > weights( 4 * length_ );
+	long base(0); // grid index of the best total score
+	unsigned bins(1);
+	for ( unsigned i(0); i < length_; ++i ) {
+		long best( std::numeric_limits< long >::max() ), worst( std::numeric_limits< long >::min() );
+		for ( unsigned c(0); c < 4; ++c ) {
+			double const scaled( score( i, letters[c] ) / step );
+			weights[ 4*i + c ] = exact ? floor( scaled + 0.5 ) : floor( scaled );
+			best = std::min( best, weights[ 4*i + c ] );
+			worst = std::max( worst, weights[ 4*i + c ] );
+		}
+		for ( unsigned c(0); c < 4; ++c ) weights[ 4*i + c ] -= best;
+		base += best;
+		bins += worst - best;
+	}
+
+	// probability of each total score over the positions so far, from the best score up
+	std::vector< double > distribution( bins, 0. ), next( bins );
+	distribution[0] = 1.;
+	unsigned used(1); // bins reachable so far
+	for ( unsigned i(0); i < length_; ++i ) {
+		unsigned reach( used );
+		std::fill( next.begin(), next.end(), 0. );
+		for ( unsigned c(0); c < 4; ++c ) {
+			long const weight( weights[ 4*i + c ] );
+			double const p( background[c] );
+			for ( unsigned s(0); s < used; ++s ) next[ s + weight ] += distribution[s] * p;
+			reach = std::max< unsigned >( reach, used + weight );
+		}
+		distribution.swap( next );
+		used = reach;
+	}
+
+	// lowest scores are best
+	long cutoff( -1 );
+	double cumulative(0.);
+	for ( unsigned s(0); s < used; ++s ) {
+		cumulative += distribution[s];
+		if ( cumulative > pvalue * ( 1 + 1e-9 ) ) break;
+		cutoff = s;
+	}
+	if ( outputlevel_ >= VERBOSE ) {
+		unsigned scores(0);
+		for ( unsigned s(0); s < used; ++s ) if ( distribution[s] > 0. ) ++scores;
+		std::cout << "Score distribution has " << scores << " distinct scores" << std::endl;
+		if ( !exact ) {
+			std::cout << "p-value cutoff is approximate: weights rounded down to steps of " << step << std::endl;
+		}
+	}
+	// half way to the next grid score, clear of any rounding in the search (and, for rounded weights,
+	// still short of the next grid score, the least any window beyond the cutoff can score)
+	return ( base + cutoff + 0.5 ) * step;
+}
+
 std::ostream & operator << ( std::ostream & out, PSSM const & pssm )
 {
 	pssm.print( out );
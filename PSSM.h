@@ -6,6 +6,7 @@
 #define INCLUDED_PSSM
 
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "util.h"
@@ -37,6 +38,17 @@ class PssmPos {
 
 std::ostream & operator << ( std::ostream & out, PssmPos const & pssm_pos );
 
+////////////////////////////////////////////////////////////////////////////////
+//// a run of adjacent matrix positions scored with a single table lookup
+struct PssmBlock {
+	unsigned offset; // first position within the window
+	unsigned length;
+	// summed weights of all 4^length runs of A, C, G or T, indexed by their 2-bit codes (first base
+	// in the lowest bits)
+	std::vector< float > weights;
+	float bestcase; // best additional score possible from the blocks after this one
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //// the full PS matrix
 class PSSM {
@@ -44,20 +56,61 @@ class PSSM {
 	public:
 		PSSM() : length_(0), outputlevel_(NORMAL) {}
 
-		void setup( std::string const & filename, bool invert, OutputLevel level = NORMAL );
-		void setup( std::string const & target);
+		// false if the file cannot be read or is malformed (see error())
+		bool setup( std::string const & filename, bool invert, OutputLevel level = NORMAL );
+		bool setup( std::string const & target, OutputLevel level = NORMAL );
+		// what made setup fail
+		std::string const & error() const { return error_; }
 
 		unsigned length() const { return length_; }
 		int priority( unsigned siteindex ) const { return priority_[siteindex]; }
+		// priority order in reverse-complement coordinates (same best cases apply)
+		int rcpriority( unsigned siteindex ) const { return length_ - priority_[siteindex] - 1; }
 		void print( std::ostream & out = std::cout ) const;
 		float bestcase( unsigned siteindex ) const { return best_cases_[siteindex]; }
-		float score( int siteindex, char letter ) const;
+
+		// weight lookups by raw sequence byte (either case; 'N' and unknown letters score 0)
+		float score( int siteindex, char letter ) const
+		{
+			return table_[ ( siteindex << 8 ) + (unsigned char)letter ];
+		}
+		// the reverse-complemented matrix: scores a forward-strand base at position siteindex of the
+		// window as the complementary base at position length-siteindex-1 of the reverse strand site
+		float rcscore( int siteindex, char letter ) const
+		{
+			return rctable_[ ( siteindex << 8 ) + (unsigned char)letter ];
+		}
+		// all 256 weights for one position
+		float const * table( int siteindex ) const { return &table_[ siteindex << 8 ]; }
+		float const * rctable( int siteindex ) const { return &rctable_[ siteindex << 8 ]; }
+
 		float bestweight( int siteindex ) const { return positions_[siteindex].bestweight(); }
+		// consensus positions weigh -1 for the bases they accept and 0 for anything else (N included)
+		// the accepted bases as bits 0-3 (A, C, G, T), or -1 for a position with other weights
+		int consensus( int siteindex ) const { return consensus_[siteindex]; }
+
+		// the matrix cut into blocks of up to blocklength positions, in scoring priority order
+		// (only valid for sites without N)
+		static unsigned const blocklength = 4;
+		// start of the run of length positions that come first in priority order overall
+		unsigned seed_offset( unsigned length ) const;
+
+		// the highest score cutoff passed by at most a fraction pvalue of random sites drawn from the
+		// background base composition (A, C, G, T), from the score distribution (exact for weights with
+		// few decimals, else computed on a grid that errs towards fewer sites)
+		float pvalue_cutoff( double pvalue, std::vector< double > const & background ) const;
+		std::vector< PssmBlock > const & blocks() const { return blocks_; }
+		std::vector< PssmBlock > const & rcblocks() const { return rcblocks_; }
 
 	private:
-		void parse_key( std::string const & line );
-		void readfile( std::string const & filename, bool invert );
+		bool parse_key( std::string const & line );
+		bool readfile( std::string const & filename, bool invert );
+		// records the error (and reports it, unless silent); always false
+		bool fail( std::string const & error );
 		void set_priority_and_best_cases();
+		void build_tables();
+		void build_blocks();
+		std::vector< PssmBlock > make_blocks( std::vector< float > const & table ) const;
 
 	private:
 		std::vector< int > priority_;
@@ -65,7 +118,11 @@ class PSSM {
 		std::vector< PssmPos > positions_;
 		unsigned length_;
 		std::vector< float > best_cases_;
+		std::vector< float > table_, rctable_; // 256 entries per position
+		std::vector< int > consensus_;
+		std::vector< PssmBlock > blocks_, rcblocks_;
 		OutputLevel outputlevel_;
+		std::string error_;
 
 };
 
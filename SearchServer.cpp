@@ -0,0 +1,292 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm> // std::max
+#include <chrono>
+#include <csignal> // signal, SIGPIPE
+#include <cstring> // memset, strncpy
+#include <map>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h> // sockaddr_un
+#include <unistd.h> // read, write, close, unlink
+
+#include "SearchServer.h"
+#include "TargetSearch.h"
+
+SearchServer::SearchServer(
+	std::list< std::string > const & filenames,
+	OutputLevel level // = NORMAL
+)
+	: batchwindow_( 5 ),
+		outputlevel_( level )
+{
+	for ( std::list< std::string >::const_iterator name( filenames.begin() ); name != filenames.end(); ++name ) {
+		genelists_.push_back( std::unique_ptr< GeneList >( new GeneList( *name, outputlevel_ ) ) );
+	}
+}
+
+//// stdout carries nothing but results
+void
+SearchServer::serve_stdin()
+{
+	std::streambuf * const log( std::cout.rdbuf( std::cerr.rdbuf() ) );
+	if ( outputlevel_ >= MINIMAL ) std::cerr << "Ready for queries" << std::endl;
+	serve( -1, STDIN_FILENO, STDOUT_FILENO );
+	std::cout.rdbuf( log );
+}
+
+bool
+SearchServer::serve_socket( std::string const & path )
+{
+	int const listener( socket( AF_UNIX, SOCK_STREAM, 0 ) );
+	sockaddr_un address;
+	memset( &address, 0, sizeof( address ) );
+	address.sun_family = AF_UNIX;
+	if ( listener < 0 || path.size() >= sizeof( address.sun_path ) ) {
+		if ( listener >= 0 ) close( listener );
+		if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: unable to create socket " << path << std::endl;
+		return false;
+	}
+	strncpy( address.sun_path, path.c_str(), sizeof( address.sun_path ) - 1 );
+	unlink( path.c_str() );
+	if ( bind( listener, reinterpret_cast< sockaddr * >( &address ), sizeof( address ) ) != 0 ||
+	     listen( listener, 16 ) != 0 ) {
+		close( listener );
+		if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: unable to listen on socket " << path << std::endl;
+		return false;
+	}
+	if ( outputlevel_ >= NORMAL ) std::cout << "Listening on " << path << std::endl;
+	serve( listener, -1, -1 );
+	close( listener );
+	unlink( path.c_str() );
+	return true;
+}
+
+//// writes all of text, unless the other end has gone away
+static void
+write_all(
+	int fd,
+	std::string const & text
+)
+{
+	for ( size_t sent(0); sent < text.size(); ) {
+		ssize_t const n( write( fd, text.data() + sent, text.size() - sent ) );
+		if ( n <= 0 ) return;
+		sent += n;
+	}
+}
+
+//// a single-threaded event loop: input is gathered from all connections without blocking on any of
+//// them; once the batch window of the oldest pending query has passed (or there is no more input to
+//// wait for), every pending query is answered together and the results are sent back in order
+void
+SearchServer::serve(
+	int listener,
+	int in,
+	int out
+)
+{
+	typedef std::chrono::steady_clock Clock;
+	// clients that hang up early must not take the server with them
+	signal( SIGPIPE, SIG_IGN );
+
+	std::vector< Connection > connections;
+	if ( in >= 0 ) {
+		Connection console = { in, out, "", 0, true };
+		connections.push_back( console );
+	}
+	// pending queries by connection index
+	std::vector< std::pair< unsigned, std::string > > pending;
+	Clock::time_point due;
+	bool running( true );
+
+	while ( true ) {
+		std::vector< pollfd > fds;
+		std::vector< unsigned > polled; // connection index of each of fds after the listener
+		if ( running && listener >= 0 ) {
+			pollfd const fd = { listener, POLLIN, 0 };
+			fds.push_back( fd );
+		}
+		for ( unsigned c(0); running && c < connections.size(); ++c ) {
+			if ( !connections[c].open ) continue;
+			pollfd const fd = { connections[c].in, POLLIN, 0 };
+			fds.push_back( fd );
+			polled.push_back( c );
+		}
+		if ( fds.empty() && pending.empty() ) break;
+
+		int timeout( -1 );
+		if ( !pending.empty() ) {
+			timeout = std::max( 0, int( std::chrono::duration_cast< std::chrono::milliseconds >(
+				due - Clock::now() ).count() ) );
+		}
+		if ( !fds.empty() && poll( &fds[0], fds.size(), timeout ) < 0 ) continue;
+
+		unsigned f(0);
+		if ( running && listener >= 0 ) {
+			if ( fds[f++].revents & POLLIN ) {
+				int const client( accept( listener, 0, 0 ) );
+				if ( client >= 0 ) {
+					Connection connection = { client, client, "", 0, true };
+					connections.push_back( connection );
+				}
+			}
+		}
+		for ( unsigned p(0); p < polled.size(); ++p, ++f ) {
+			if ( !fds[f].revents ) continue;
+			Connection & connection( connections[ polled[p] ] );
+			char buffer[ 1 << 12 ];
+			ssize_t const got( read( connection.in, buffer, sizeof( buffer ) ) );
+			if ( got <= 0 ) { connection.open = false; continue; }
+			connection.pending.append( buffer, got );
+			size_t eol;
+			while ( running && ( eol = connection.pending.find( '\n' ) ) != std::string::npos ) {
+				std::string line( connection.pending.substr( 0, eol ) );
+				connection.pending.erase( 0, eol + 1 );
+				if ( !line.empty() && line[ line.size() - 1 ] == '\r' ) line.erase( line.size() - 1 );
+				if ( line.empty() ) continue;
+				if ( line == "quit" ) { running = false; break; }
+				if ( pending.empty() ) due = Clock::now() + std::chrono::milliseconds( batchwindow_ );
+				pending.push_back( std::make_pair( polled[p], line ) );
+				++connection.queries;
+			}
+		}
+
+		// answer the batch once its window has passed, or as soon as nothing more can join it
+		bool waiting( false );
+		for ( unsigned c(0); c < connections.size(); ++c ) waiting = waiting || connections[c].open;
+		if ( !pending.empty() && ( !running || Clock::now() >= due || ( !waiting && listener < 0 ) ) ) {
+			std::vector< std::string > queries, results;
+			for ( unsigned q(0); q < pending.size(); ++q ) queries.push_back( pending[q].second );
+			answer( queries, results );
+			for ( unsigned q(0); q < pending.size(); ++q ) {
+				Connection & connection( connections[ pending[q].first ] );
+				write_all( connection.out, results[q] );
+				--connection.queries;
+			}
+			pending.clear();
+		}
+
+		// hang up on clients that are done (never on the console)
+		for ( unsigned c(0); c < connections.size(); ) {
+			Connection const & connection( connections[c] );
+			if ( connection.in == in || connection.open || connection.queries ) { ++c; continue; }
+			close( connection.in );
+			connections.erase( connections.begin() + c );
+			for ( unsigned q(0); q < pending.size(); ++q ) if ( pending[q].first > c ) --pending[q].first;
+		}
+		if ( !running && pending.empty() ) break;
+	}
+	for ( unsigned c(0); c < connections.size(); ++c ) {
+		if ( connections[c].in != in ) close( connections[c].in );
+	}
+}
+
+//// problems with a query are reported back rather than ending the server
+bool
+SearchServer::parse(
+	std::string const & query,
+	SearchOptions & options,
+	std::vector< std::string > & pssms,
+	std::string & error
+) const
+{
+	std::vector< std::string > args( 1, "query" );
+	std::istringstream words( query );
+	std::string word;
+	while ( words >> word ) args.push_back( word );
+
+	options.outputlevel = outputlevel_;
+	for ( unsigned i(1); i < args.size(); ++i ) {
+		unsigned const option( i );
+		if ( !options.parse( args, i ) ) {
+			error = "ERROR: unknown option " + args[i];
+			return false;
+		}
+		if ( options.bad ) {
+			error = "ERROR: bad value for " + args[option];
+			return false;
+		}
+	}
+	if ( !options.matrices( pssms ) ) {
+		error = "ERROR: couldn't open " + options.pssmlistname;
+		return false;
+	}
+	// each matrix is loaded here as well, so that a bad one fails its own query rather than its batch
+	for ( std::vector< std::string >::const_iterator name( pssms.begin() ); name != pssms.end(); ++name ) {
+		PSSM pssm;
+		bool const loaded( options.simple_target ? pssm.setup( *name, SILENT ) : pssm.setup( *name, options.invert_pssm, SILENT ) );
+		if ( !loaded ) {
+			error = "ERROR: " + pssm.error();
+			return false;
+		}
+	}
+	return true;
+}
+
+//// queries that agree on everything but their matrices and per-matrix limits share one
+//// TargetSearch: each window is scored against all of their matrices at once, and each query's
+//// results are printed from its own range of them
+void
+SearchServer::answer(
+	std::vector< std::string > const & queries,
+	std::vector< std::string > & results
+)
+{
+	results.assign( queries.size(), "" );
+	std::vector< SearchOptions > options( queries.size() );
+	std::vector< std::vector< std::string > > pssms( queries.size() );
+	// queries that can be searched together, by the settings they share
+	std::map< std::string, std::vector< unsigned > > batches;
+	for ( unsigned q(0); q < queries.size(); ++q ) {
+		std::string error;
+		if ( !parse( queries[q], options[q], pssms[q], error ) ) {
+			results[q] = error + "\n//\n";
+			continue;
+		}
+		SearchOptions const & o( options[q] );
+		std::ostringstream key;
+		key << o.simple_target << o.invert_pssm << o.warmstart << o.suffixarray << ' '
+		    << o.seedlength << ' ' << o.threads << ' ' << o.outputlevel;
+		batches[ key.str() ].push_back( q );
+	}
+	if ( outputlevel_ >= NORMAL && queries.size() > 1 ) {
+		std::cout << "Answering " << queries.size() << " queries in " << batches.size()
+		          << ( batches.size() == 1 ? " pass" : " passes" ) << std::endl;
+	}
+
+	for ( std::map< std::string, std::vector< unsigned > >::const_iterator batch( batches.begin() );
+	      batch != batches.end(); ++batch ) {
+		std::vector< unsigned > const & members( batch->second );
+		SearchOptions const & shared( options[ members.front() ] );
+		std::vector< std::string > all;
+		std::vector< unsigned > first;
+		for ( std::vector< unsigned >::const_iterator q( members.begin() ); q != members.end(); ++q ) {
+			first.push_back( all.size() );
+			all.insert( all.end(), pssms[*q].begin(), pssms[*q].end() );
+		}
+		TargetSearch search( all, 0, shared.simple_target, shared.invert_pssm, shared.outputlevel );
+		if ( !search.good() ) {
+			// (a matrix file changed since its query was parsed)
+			for ( unsigned m(0); m < members.size(); ++m ) results[ members[m] ] = "ERROR: " + search.error() + "\n//\n";
+			continue;
+		}
+		search.threads( shared.threads );
+		search.warmstart( shared.warmstart );
+		search.suffixarray( shared.suffixarray );
+		search.seedlength( shared.seedlength );
+		for ( unsigned m(0); m < members.size(); ++m ) {
+			options[ members[m] ].configure( search, first[m], pssms[ members[m] ].size() );
+		}
+		for ( unsigned g(0); g < genelists_.size(); ++g ) search.scan_genes( *genelists_[g] );
+		for ( unsigned m(0); m < members.size(); ++m ) {
+			std::ostringstream out;
+			search.print_results( out, first[m], pssms[ members[m] ].size() );
+			out << "//" << std::endl;
+			results[ members[m] ] = out.str();
+		}
+	}
+}
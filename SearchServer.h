@@ -0,0 +1,67 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_SearchServer
+#define INCLUDED_SearchServer
+
+#include <iostream>
+#include <list>
+#include <memory> // std::unique_ptr
+#include <string>
+#include <vector>
+
+#include "Sequence.h"
+#include "TargetSearch.h"
+#include "util.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// keeps sequence files loaded and answers any number of searches of them
+/// a query is one line of search options as on the command line (e.g. "-p mso_wt.pssm -n 50");
+/// the results are those of a normal run, followed by a line "//"
+/// "quit" stops the server
+/// queries pending together (from any number of clients) are batched: those with compatible
+/// options are searched for in a single pass over the sequences, and each gets its own results
+class SearchServer {
+
+	public:
+		SearchServer( std::list< std::string > const & filenames, OutputLevel level = NORMAL );
+
+		// queries arriving within this many milliseconds of the first one pending join its batch
+		void batchwindow( unsigned milliseconds ) { batchwindow_ = milliseconds; }
+
+		// queries from stdin, results to stdout (progress messages go to stderr instead)
+		void serve_stdin();
+		// queries from any number of clients of a Unix domain socket (false if it cannot be opened)
+		bool serve_socket( std::string const & path );
+
+		// results[q] (each ending in "//") for queries[q]
+		void answer( std::vector< std::string > const & queries, std::vector< std::string > & results );
+
+	private:
+		// one source of queries and destination of their results
+		struct Connection {
+			int in, out;
+			std::string pending; // unfinished query line
+			unsigned queries; // number awaiting results
+			bool open; // still reading queries
+		};
+
+		// answer queries from clients of listener (if >= 0) and from in (if >= 0), until "quit" or the
+		// end of all input
+		void serve( int listener, int in, int out );
+		// the options of a query and the matrices they name (false with error set if they are unusable)
+		bool parse( std::string const & query, SearchOptions & options,
+		            std::vector< std::string > & pssms, std::string & error ) const;
+
+		// not copyable
+		SearchServer( SearchServer const & );
+		SearchServer & operator = ( SearchServer const & );
+
+	private:
+		std::vector< std::unique_ptr< GeneList > > genelists_;
+		unsigned batchwindow_;
+		OutputLevel outputlevel_;
+};
+
+#endif
@@ -2,36 +2,401 @@
 // Justin Ashworth 2007
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#include <cstring> // memchr, memcmp
 #include <fstream>
-#include <algorithm> // std::transform
+#include <limits>
+#include <algorithm> // std::sort, std::max
+#include <unistd.h> // close, dup
+#include <zlib.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SEQUENCE_SSE2
+#endif
+
+#include "MappedFile.h"
 #include "Sequence.h"
+#include "TaskScheduler.h"
 #include "util.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+BadLetters::add( BadLetters const & later, uint64_t offset )
+{
+	if ( count == 0 && later.count > 0 ) {
+		first = later.first;
+		position = offset + later.position;
+	}
+	count += later.count;
+}
+
+void
+BadLetters::report( std::string const & name ) const
+{
+	if ( count == 0 ) return;
+	std::cerr << "WARNING: " << name << ": skipped " << count << " unrecognized letter" << ( count > 1 ? "s" : "" )
+	          << " (the first, '" << first << "', after " << position << " bases)" << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// 2-bit packed nucleotide storage
+PackedSequence::PackedSequence( PackedSequence const & other )
+	: words_( other.words_ ),
+		nmask_( other.nmask_ ),
+		data_( other.data_ == other.words_.data() ? words_.data() : other.data_ ),
+		size_( other.size_ )
+{}
+
+PackedSequence &
+PackedSequence::operator = ( PackedSequence const & other )
+{
+	if ( this == &other ) return *this;
+	words_ = other.words_;
+	nmask_ = other.nmask_;
+	data_ = other.data_ == other.words_.data() ? words_.data() : other.data_;
+	size_ = other.size_;
+	return *this;
+}
+
+//// words shared with a range of bases packed by another thread are or-ed in atomically
+static void
+store( uint64_t & word, uint64_t value, bool shared )
+{
+	if ( shared ) __atomic_fetch_or( &word, value, __ATOMIC_RELAXED );
+	else word = value;
+}
+
+static uint64_t
+lowbits( unsigned count )
+{
+	return count >= 64 ? ~uint64_t(0) : ( uint64_t(1) << count ) - 1;
+}
+
+//// one bit per character: nucleotides (valid) and whitespace (space); codes holds the 2-bit codes of
+//// the nucleotides, with N as 0 and flagged in nflags
+//// for letters of either case, bits 1 and 2 of the code are bits 1^2 and 2^3 of ASCII:
+//// A 0x41 -> 0, C 0x43 -> 1, G 0x47 -> 2, T 0x54 -> 3, N 0x4e -> 0
+struct TextBits {
+	uint64_t valid, space, codes, nflags;
+};
+
+//// spreads 32 bits out to the even bits of a word
+static uint64_t
+spread( uint64_t x )
+{
+	x = ( x | x << 16 ) & 0x0000ffff0000ffffULL;
+	x = ( x | x << 8 ) & 0x00ff00ff00ff00ffULL;
+	x = ( x | x << 4 ) & 0x0f0f0f0f0f0f0f0fULL;
+	x = ( x | x << 2 ) & 0x3333333333333333ULL;
+	x = ( x | x << 1 ) & 0x5555555555555555ULL;
+	return x;
+}
+
+static TextBits
+classify( char const * text, unsigned length )
+{
+	TextBits bits = { 0, 0, 0, 0 };
+#ifdef SEQUENCE_SSE2
+	if ( length == 32 ) {
+		uint64_t lo(0), hi(0);
+		for ( unsigned half(0); half < 2; ++half ) {
+			__m128i const x( _mm_loadu_si128( reinterpret_cast< __m128i const * >( text + 16*half ) ) );
+			__m128i const u( _mm_and_si128( x, _mm_set1_epi8( char(0xdf) ) ) ); // upper case
+			__m128i const n( _mm_cmpeq_epi8( u, _mm_set1_epi8('N') ) );
+			__m128i const valid( _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( u, _mm_set1_epi8('A') ),
+			                                                 _mm_cmpeq_epi8( u, _mm_set1_epi8('C') ) ),
+			                                   _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( u, _mm_set1_epi8('G') ),
+			                                                               _mm_cmpeq_epi8( u, _mm_set1_epi8('T') ) ), n ) ) );
+			// '\t' to '\r' are 9 to 13
+			__m128i const control( _mm_sub_epi8( x, _mm_set1_epi8(9) ) );
+			__m128i const space( _mm_or_si128( _mm_cmpeq_epi8( _mm_min_epu8( control, _mm_set1_epi8(4) ), control ),
+			                                   _mm_cmpeq_epi8( x, _mm_set1_epi8(' ') ) ) );
+			unsigned const shift( 16*half );
+			bits.valid |= uint64_t( _mm_movemask_epi8( valid ) ) << shift;
+			bits.space |= uint64_t( _mm_movemask_epi8( space ) ) << shift;
+			bits.nflags |= uint64_t( _mm_movemask_epi8( n ) ) << shift;
+			// (16-bit shifts: a byte's bit 7 only ever receives its own lower bits)
+			uint64_t const bit1( _mm_movemask_epi8( _mm_slli_epi16( x, 6 ) ) );
+			uint64_t const bit2( _mm_movemask_epi8( _mm_slli_epi16( x, 5 ) ) );
+			uint64_t const bit3( _mm_movemask_epi8( _mm_slli_epi16( x, 4 ) ) );
+			lo |= ( bit1 ^ bit2 ) << shift;
+			hi |= ( bit2 ^ bit3 ) << shift;
+		}
+		bits.codes = spread( lo ) | spread( hi ) << 1;
+		bits.nflags &= bits.valid;
+		return bits;
+	}
+#endif
+	for ( unsigned i(0); i < length; ++i ) {
+		unsigned const c( nucleotide_classes[ (unsigned char)text[i] ] );
+		if ( c == NUC_SPACE ) bits.space |= uint64_t(1) << i;
+		if ( c >= NUC_SPACE ) continue;
+		bits.valid |= uint64_t(1) << i;
+		if ( c == NUC_N ) bits.nflags |= uint64_t(1) << i;
+		else bits.codes |= uint64_t(c) << 2*i;
+	}
+	return bits;
+}
 
-//// read and filter a line of input sequence from the file stream
-void Gene::readline( std::string const & line )
+//// reads text 32 characters at a time, passing runs of consecutive nucleotides to
+//// sink.bases( codes, nflags, count ), up to maxbases of them; returns the number of characters read
+template < typename Sink >
+static uint64_t
+scan_text(
+	char const * text,
+	uint64_t length,
+	uint64_t maxbases,
+	Sink & sink,
+	BadLetters & bad
+)
 {
-	unsigned const nchar(line.size());
-	// use temporary filter container to avoid constly multiple redimensioning
-	std::vector< char > clean(nchar);
-	unsigned nclean(0);
-	// filter quickly/efficiently
-	for ( unsigned i(0); i < nchar; ++i ) {
-		if ( isnuc(line[i]) ) clean[nclean++] = line[i];
-		else std::cerr << name_ << ": unrecognized letter (" << line[i] << ") at position " << i << std::endl;
+	uint64_t done(0); // bases so far
+	for ( uint64_t c(0); c < length; c += 32 ) {
+		unsigned const n( std::min< uint64_t >( 32, length - c ) );
+		TextBits const bits( classify( text + c, n ) );
+		uint64_t valid( bits.valid ), used( n );
+		unsigned count( __builtin_popcountll( valid ) );
+		if ( done + count > maxbases ) {
+			// stop right after the last base wanted
+			uint64_t rest( valid );
+			for ( uint64_t k( maxbases - done ); k > 0; --k ) rest &= rest - 1;
+			valid ^= rest;
+			used = __builtin_ctzll( rest );
+			count = maxbases - done;
+		}
+		uint64_t const others( ~( bits.valid | bits.space ) & lowbits( used ) );
+		if ( others ) {
+			if ( bad.count == 0 ) {
+				unsigned const first( __builtin_ctzll( others ) );
+				bad.first = text[ c + first ];
+				bad.position = done + __builtin_popcountll( valid & lowbits( first ) );
+			}
+			bad.count += __builtin_popcountll( others );
+		}
+		while ( valid ) {
+			unsigned const start( __builtin_ctzll( valid ) );
+			unsigned const run( __builtin_ctzll( ~( valid >> start ) ) );
+			sink.bases( ( bits.codes >> 2*start ) & lowbits( 2*run ), ( bits.nflags >> start ) & lowbits( run ), run );
+			valid &= ~( lowbits( run ) << start );
+		}
+		done += count;
+		if ( used < n || done == maxbases ) return c + used;
 	}
-	sequence_.insert( sequence_.end(), clean.begin(), clean.begin() + nclean );
+	return length;
 }
 
+struct CountSink {
+	CountSink() : total(0) {}
+	void bases( uint64_t, uint64_t, unsigned count ) { total += count; }
+	uint64_t total;
+};
+
+//// bases are gathered a word at a time; only the first and last words of a range may be shared with
+//// another range, and the words in between are simply stored
+struct PackSink {
+	PackSink( uint64_t * words, uint64_t * nmask, uint64_t index )
+		: words( words ), nmask( nmask ), i( index ), codes(0), nflags(0), firstword( true ), firstnword( true )
+	{}
+
+	void bases( uint64_t runcodes, uint64_t runnflags, unsigned count )
+	{
+		unsigned const shift( ( i & 31 ) << 1 ), nshift( i & 63 );
+		codes |= runcodes << shift;
+		if ( ( i & 31 ) + count >= 32 ) {
+			store( words[ i >> 5 ], codes, firstword );
+			firstword = false;
+			codes = shift ? runcodes >> ( 64 - shift ) : 0;
+		}
+		nflags |= runnflags << nshift;
+		if ( nshift + count >= 64 ) {
+			store( nmask[ i >> 6 ], nflags, firstnword );
+			firstnword = false;
+			nflags = nshift ? runnflags >> ( 64 - nshift ) : 0;
+		}
+		i += count;
+	}
+
+	void finish()
+	{
+		if ( i & 31 ) store( words[ i >> 5 ], codes, true );
+		if ( i & 63 ) store( nmask[ i >> 6 ], nflags, true );
+	}
+
+	uint64_t * words, * nmask;
+	uint64_t i, codes, nflags;
+	bool firstword, firstnword;
+};
+
+void
+PackedSequence::push_back( char nucleotide )
+{
+	unsigned const c( nucleotide_classes[ (unsigned char)nucleotide ] );
+	if ( c == NUC_N ) nmask_[ size_ >> 6 ] |= uint64_t(1) << ( size_ & 63 );
+	else words_[ size_ >> 5 ] |= uint64_t(c) << ( ( size_ & 31 ) << 1 );
+	++size_;
+	// keep one zero word beyond the last one in use
+	if ( ( size_ >> 5 ) + 1 >= words_.size() ) {
+		words_.push_back( 0 );
+		data_ = words_.data();
+	}
+	if ( ( size_ >> 6 ) + 1 >= nmask_.size() ) nmask_.push_back( 0 );
+}
+
+//// the words past size_ are zero, so the new bases need not be cleared
 void
-Gene::finalize()
+PackedSequence::resize( uint64_t size )
+{
+	words_.resize( ( size >> 5 ) + 2, 0 );
+	nmask_.resize( ( size >> 6 ) + 2, 0 );
+	data_ = words_.data();
+	size_ = size;
+}
+
+uint64_t
+PackedSequence::count(
+	char const * text,
+	uint64_t length,
+	BadLetters & bad
+)
 {
-	if ( finalized_ ) return;
-	// ensure all upper-case
-	std::transform( sequence_.begin(), sequence_.end(), sequence_.begin(), upper );
-	finalized_ = true;
+	CountSink sink;
+	scan_text( text, length, ~uint64_t(0), sink, bad );
+	return sink.total;
+}
+
+uint64_t
+PackedSequence::pack(
+	uint64_t index,
+	char const * text,
+	uint64_t length,
+	BadLetters & bad
+)
+{
+	PackSink sink( &words_[0], &nmask_[0], index );
+	scan_text( text, length, ~uint64_t(0), sink, bad );
+	sink.finish();
+	return sink.i - index;
+}
+
+//// room is made for every character to be a base, and given back afterwards
+uint64_t
+PackedSequence::append(
+	char const * text,
+	uint64_t length,
+	BadLetters & bad,
+	uint64_t maxsize // = ~uint64_t(0)
+)
+{
+	if ( size_ >= maxsize ) return 0;
+	uint64_t const room( size_ + std::min( length, maxsize - size_ ) );
+	words_.resize( ( room >> 5 ) + 2, 0 );
+	nmask_.resize( ( room >> 6 ) + 2, 0 );
+	data_ = words_.data();
+	PackSink sink( &words_[0], &nmask_[0], size_ );
+	uint64_t const used( scan_text( text, length, maxsize - size_, sink, bad ) );
+	sink.finish();
+	size_ = sink.i;
+	words_.resize( ( size_ >> 5 ) + 2 );
+	nmask_.resize( ( size_ >> 6 ) + 2 );
+	return used;
+}
+
+void
+PackedSequence::borrow( uint64_t const * words, uint64_t size )
+{
+	std::vector< uint64_t >().swap( words_ );
+	nmask_.assign( ( size >> 6 ) + 2, 0 );
+	data_ = words;
+	size_ = size;
+}
+
+void
+PackedSequence::setN( uint64_t index, uint64_t count )
+{
+	for ( uint64_t i( index ); i < index + count; ++i ) nmask_[ i >> 6 ] |= uint64_t(1) << ( i & 63 );
+}
+
+std::vector< std::pair< uint64_t, uint64_t > >
+PackedSequence::nruns() const
+{
+	std::vector< std::pair< uint64_t, uint64_t > > runs;
+	for ( uint64_t i(0); i < size_; ) {
+		uint64_t const flags( nbits(i) );
+		if ( !flags ) { i += 64; continue; }
+		uint64_t const start( i + __builtin_ctzll( flags ) );
+		// the first base after the run: whole words of N, then the rest of the last one
+		for ( i = start; i < size_ && !~nbits(i); i += 64 ) {}
+		if ( i < size_ ) i += __builtin_ctzll( ~nbits(i) );
+		i = std::min( i, size_ );
+		runs.push_back( std::make_pair( start, i - start ) );
+	}
+	return runs;
+}
+
+void
+PackedSequence::reserve( uint64_t size )
+{
+	if ( data_ != words_.data() ) return;
+	words_.reserve( ( size >> 5 ) + 2 );
+	nmask_.reserve( ( size >> 6 ) + 2 );
+	data_ = words_.data();
+}
+
+//// release excess capacity left over from incremental reading
+void
+PackedSequence::shrink()
+{
+	if ( data_ == words_.data() ) {
+		std::vector< uint64_t >( words_ ).swap( words_ );
+		data_ = words_.data();
+	}
+	std::vector< uint64_t >( nmask_ ).swap( nmask_ );
+}
+
+void
+PackedSequence::clear()
+{
+	// assign keeps capacity
+	words_.assign( 2, 0 );
+	nmask_.assign( 2, 0 );
+	data_ = words_.data();
+	size_ = 0;
+}
+
+//// e.g. the bases carried over between blocks of a streamed sequence
+void
+PackedSequence::keep_tail( uint64_t count )
+{
+	if ( count >= size_ ) return;
+	std::vector< char > tail;
+	for ( uint64_t i( size_ - count ); i < size_; ++i ) tail.push_back( base(i) );
+	clear();
+	for ( std::vector< char >::const_iterator b( tail.begin() ); b != tail.end(); ++b ) push_back( *b );
+}
+
+char
+PackedSequence::base( uint64_t index ) const
+{
+	static char const letters[] = { 'A', 'C', 'G', 'T' };
+	if ( isN( index ) ) return 'N';
+	return letters[ code( index ) ];
+}
+
+std::ostream & operator << ( std::ostream & out, PackedSequence const & seq )
+{
+	for ( uint64_t i(0), size( seq.size() ); i < size; ++i ) out << seq.base(i);
+	return out;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//// unpacked copy of a stretch of the sequence
+std::vector< char >
+Gene::site( uint64_t start, unsigned length ) const
+{
+	std::vector< char > site( length );
+	for ( unsigned i(0); i < length; ++i ) site[i] = base( start+i );
+	return site;
 }
 
 //// abbreviated summary of the gene sequence
@@ -42,12 +407,13 @@ Gene::print( std::ostream & out ) const
 	if ( name_.size() < maxhdr ) out << name_;
 	else out << name_.substr(0,15);
 	out << ": ";
-	unsigned seqsize( sequence_.size() );
-	if ( seqsize <= maxseq ) out << sequence_;
-	else {
-		for ( unsigned i(0); i < maxseq/2; ++i ) out << sequence_[i];
+	uint64_t seqsize( size_ );
+	if ( seqsize <= maxseq ) {
+		for ( uint64_t i(0); i < seqsize; ++i ) out << base(i);
+	} else {
+		for ( unsigned i(0); i < maxseq/2; ++i ) out << base(i);
 		out << " ... ";
-		for ( unsigned i(maxseq/2); i > 0; --i ) out << sequence_[seqsize-i];
+		for ( unsigned i(maxseq/2); i > 0; --i ) out << base(seqsize-i);
 	}
 	out << " (" << seqsize << " bp)" << std::endl;
 }
@@ -61,60 +427,350 @@ std::ostream & operator<< ( std::ostream & out, Gene const & gene )
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 /// container and manager for a list of genes
+
+// binary genome file layout, in 64-bit words
+static char const index_magic[] = "PSSMGEN1";
+struct IndexHeader {
+	char magic[8];
+	uint64_t numgenes, numbases, numnruns, namebytes, numsuffixes;
+};
+
+// take count entries of size bytes from the left bytes of a binary genome file (false if there are
+// fewer left, without overflow for any count)
+static bool take( uint64_t & left, uint64_t count, uint64_t size )
+{
+	if ( count > left / size ) return false;
+	left -= count * size;
+	return true;
+}
+
 void GeneList::finalize()
 {
-	if ( genes_.size() != 0 ) {
-		for ( std::vector< Gene >::iterator gene( genes_.begin() );
-		      gene != genes_.end(); ++gene ) {
-			gene->finalize();
-		}
-	}
-	else std::cerr << "ERROR: no genes in the list!" << std::endl;
+	if ( genes_.size() == 0 && outputlevel_ >= MINIMAL ) std::cerr << "ERROR: no genes in the list!" << std::endl;
+	sequence_.shrink();
 
 	numseqs_ = genes_.size();
 	numbps_ = 0;
 	for ( std::vector< Gene >::const_iterator gene( genes_.begin() );
   gene != genes_.end(); ++gene ) {
-		numbps_ += gene->sequence().size();
+		numbps_ += gene->size();
 	}
 }
 
-//// opens the input file and feeds lines to the Gene class
+//// maps the input file and indexes/packs its records in one pass
 void GeneList::readfile( std::string const filename )
 {
-	std::ifstream file;
-	file.open( filename.c_str() );
+	if ( is_index( filename ) ) {
+		read_index( filename );
+		return;
+	}
 	if ( outputlevel_ >= NORMAL ) std::cout << "\nReading sequence file " << filename << std::endl;
+	MappedFile file( filename, threads_ );
+	if ( !file.good() ) {
+		good_ = false;
+		if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: unable to open sequence file " << filename << std::endl;
+	}
+	read_fasta( file.data(), file.size() );
+}
+
+//// a header is a line starting with '>'
+static char const *
+next_header( char const * text, char const * from, char const * end )
+{
+	while ( from < end ) {
+		char const * const h( static_cast< char const * >( memchr( from, '>', end - from ) ) );
+		if ( !h ) break;
+		if ( h == text || h[-1] == '\n' ) return h;
+		from = h + 1;
+	}
+	return end;
+}
 
-	// read input file
-	// using a char array is faster than reading in/parsing strings
-//	char linebuff[4096];
-	std::string line;
-	bool name_read(false);
-//	while ( file.getline( linebuff, 4096 ) ) {
-	while ( std::getline(file, line) ) {
-//		std::cout << "DEBUG: " << line << std::endl;
-
-		if ( line[0] == '>' ) { // FASTA header
-//			std::cout << "DEBUG: fasta label: " << line << std::endl;
-			name_read = true;
-			genes_.push_back( Gene(line) );
-			continue;
+//// no per-line copies: sequence letters go straight from the text into the shared buffer
+//// (text before the first header is ignored)
+void
+GeneList::read_fasta(
+	char const * text,
+	uint64_t size
+)
+{
+	if ( threads_ > 1 && size >= ( 1 << 22 ) ) {
+		read_pieces( text, size );
+		return;
+	}
+	char const * const end( text + size );
+	// at most one base per byte
+	sequence_.reserve( sequence_.size() + size );
+
+	for ( char const * header( next_header( text, text, end ) ); header < end; ) {
+		char const * eol( static_cast< char const * >( memchr( header, '\n', end - header ) ) );
+		if ( !eol ) eol = end;
+		genes_.push_back( Gene( std::string( header, eol ), &sequence_, sequence_.size() ) );
+		char const * const begin( eol < end ? eol + 1 : end ), * const next( next_header( text, eol, end ) );
+		BadLetters bad;
+		sequence_.append( begin, next - begin, bad );
+		genes_.back().size( sequence_.size() - genes_.back().offset() );
+		if ( outputlevel_ >= MINIMAL ) bad.report( genes_.back().name() );
+		header = next;
+	}
+
+	finalize();
+}
+
+//// the same as the serial read: the bases of every piece are counted first, which places each one
+//// in the shared buffer, and then packed there
+void
+GeneList::read_pieces(
+	char const * text,
+	uint64_t size
+)
+{
+	struct Piece {
+		unsigned record;
+		char const * begin, * end;
+		uint64_t bases, offset;
+		BadLetters bad;
+	};
+	char const * const end( text + size );
+	uint64_t const piecebytes( std::max< uint64_t >( 1 << 20, size / ( 4 * threads_ ) ) );
+	std::vector< std::string > names;
+	std::vector< Piece > pieces;
+	for ( char const * header( next_header( text, text, end ) ); header < end; ) {
+		char const * eol( static_cast< char const * >( memchr( header, '\n', end - header ) ) );
+		if ( !eol ) eol = end;
+		names.push_back( std::string( header, eol ) );
+		char const * const next( next_header( text, eol, end ) );
+		// long records are cut at the first line end past every piecebytes bytes
+		for ( char const * begin( eol < end ? eol + 1 : end ); begin < next; ) {
+			char const * cut( next - begin > int64_t( piecebytes ) ? begin + piecebytes : next );
+			if ( cut < next ) {
+				cut = static_cast< char const * >( memchr( cut, '\n', next - cut ) );
+				cut = cut ? cut + 1 : next;
+			}
+			Piece const piece = { unsigned( names.size() - 1 ), begin, cut, 0, 0, BadLetters() };
+			pieces.push_back( piece );
+			begin = cut;
 		}
-		if ( name_read ) {
-			genes_.back().readline(line);
-//			std::cout << "DEBUG: fasta sequence line " << line << std::endl;
+		header = next;
+	}
+
+	TaskScheduler scheduler( threads_ );
+	for ( unsigned i(0); i < pieces.size(); ++i ) {
+		scheduler.add( [&, i]( unsigned ) {
+			Piece & piece( pieces[i] );
+			piece.bases = PackedSequence::count( piece.begin, piece.end - piece.begin, piece.bad );
+		}, pieces[i].end - pieces[i].begin );
+	}
+	scheduler.run();
+
+	uint64_t offset( sequence_.size() );
+	unsigned p(0);
+	for ( unsigned r(0); r < names.size(); ++r ) {
+		genes_.push_back( Gene( names[r], &sequence_, offset ) );
+		BadLetters bad;
+		for ( ; p < pieces.size() && pieces[p].record == r; ++p ) {
+			bad.add( pieces[p].bad, offset - genes_.back().offset() );
+			pieces[p].offset = offset;
+			offset += pieces[p].bases;
 		}
+		genes_.back().size( offset - genes_.back().offset() );
+		if ( outputlevel_ >= MINIMAL ) bad.report( names[r] );
+	}
+
+	sequence_.resize( offset );
+	for ( unsigned i(0); i < pieces.size(); ++i ) {
+		scheduler.add( [&, i]( unsigned ) {
+			BadLetters counted; // (already)
+			sequence_.pack( pieces[i].offset, pieces[i].begin, pieces[i].end - pieces[i].begin, counted );
+		}, pieces[i].end - pieces[i].begin );
+	}
+	scheduler.run();
+
+	finalize();
+}
+
+//// the totals are kept up to date here rather than by finalize(), which would repack the whole
+//// buffer every time
+void
+GeneList::add(
+	std::string const & name,
+	char const * bases,
+	uint64_t size
+)
+{
+	genes_.push_back( Gene( name, &sequence_, sequence_.size() ) );
+	BadLetters bad;
+	sequence_.append( bases, size, bad );
+	genes_.back().size( sequence_.size() - genes_.back().offset() );
+	if ( outputlevel_ >= MINIMAL ) bad.report( name );
+	++numseqs_;
+	numbps_ += genes_.back().size();
+}
+
+bool
+GeneList::is_index( std::string const & filename )
+{
+	if ( filename == "-" ) return false; // (cannot be peeked at)
+	std::ifstream file( filename.c_str(), std::ios::binary );
+	char magic[8];
+	return file.read( magic, 8 ) && memcmp( magic, index_magic, 8 ) == 0;
+}
+
+//// N runs are listed rather than stored as a mask: they are few, even in large genomes
+bool
+GeneList::write_index( std::string const & filename ) const
+{
+	std::vector< uint64_t > nruns;
+	std::vector< std::pair< uint64_t, uint64_t > > const runs( sequence_.nruns() );
+	for ( std::vector< std::pair< uint64_t, uint64_t > >::const_iterator r( runs.begin() ); r != runs.end(); ++r ) {
+		nruns.push_back( r->first );
+		nruns.push_back( r->second );
+	}
+	std::string names;
+	std::vector< uint64_t > genes;
+	for ( std::vector< Gene >::const_iterator gene( genes_.begin() ); gene != genes_.end(); ++gene ) {
+		genes.push_back( gene->offset() );
+		genes.push_back( gene->size() );
+		genes.push_back( names.size() );
+		names += gene->name();
+		names += '\0';
+	}
+	names.resize( ( names.size() + 7 ) / 8 * 8 ); // keeps the file word-aligned
+
+	IndexHeader header;
+	memcpy( header.magic, index_magic, 8 );
+	header.numgenes = genes_.size();
+	header.numbases = sequence_.size();
+	header.numnruns = nruns.size() / 2;
+	header.namebytes = names.size();
+	header.numsuffixes = numsuffixes_;
+
+	std::ofstream file( filename.c_str(), std::ios::binary );
+	file.write( reinterpret_cast< char const * >( &header ), sizeof( header ) );
+	file.write( reinterpret_cast< char const * >( sequence_.words() ), sequence_.numwords() * 8 );
+	if ( !nruns.empty() ) file.write( reinterpret_cast< char const * >( &nruns[0] ), nruns.size() * 8 );
+	if ( !genes.empty() ) file.write( reinterpret_cast< char const * >( &genes[0] ), genes.size() * 8 );
+	file.write( names.data(), names.size() );
+	if ( numsuffixes_ ) file.write( reinterpret_cast< char const * >( suffixes_ ), numsuffixes_ * 4 );
+	if ( !file ) {
+		if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: unable to write binary genome file " << filename << std::endl;
+		return false;
+	}
+	if ( outputlevel_ >= NORMAL ) {
+		std::cout << "Wrote " << genes_.size() << " sequences (" << sequence_.size() << " bp) to "
+		          << filename << std::endl;
+	}
+	return true;
+}
+
+//// the list is left empty
+void
+GeneList::truncated_index( std::string const & filename )
+{
+	good_ = false;
+	index_.reset();
+	if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: truncated or corrupt binary genome file " << filename << std::endl;
+}
+
+//// nothing is parsed or copied but the N runs and gene table: the bases stay in the mapped file
+void
+GeneList::read_index( std::string const & filename )
+{
+	if ( outputlevel_ >= NORMAL ) std::cout << "\nReading binary genome file " << filename << std::endl;
+	index_.reset( new MappedFile( filename ) );
+	IndexHeader header;
+	if ( index_->size() < sizeof( header ) ) {
+		truncated_index( filename );
+		return;
+	}
+	memcpy( &header, index_->data(), sizeof( header ) );
+
+	// every section must fit in the file...
+	uint64_t const numwords( ( header.numbases >> 5 ) + 2 );
+	uint64_t left( index_->size() - sizeof( header ) );
+	if ( !take( left, numwords, 8 ) || !take( left, header.numnruns, 16 ) || !take( left, header.numgenes, 24 ) ||
+	     !take( left, header.namebytes, 1 ) || !take( left, header.numsuffixes, 4 ) ) {
+		truncated_index( filename );
+		return;
 	}
+	uint64_t const * const words( reinterpret_cast< uint64_t const * >( index_->data() + sizeof( header ) ) );
+	uint64_t const * const nruns( words + numwords );
+	uint64_t const * const genes( nruns + 2 * header.numnruns );
+	char const * const names( reinterpret_cast< char const * >( genes + 3 * header.numgenes ) );
 
-//	// get the final remaining contents of line
-//	if ( name_read ) {
-//		genes_.back().readline(line);
-////		std::cout << "DEBUG: fasta sequence final line " << line << std::endl;
-//	}
+	// ...and every run, gene and name lie within the sequence and name table, the genes back to back
+	// over the whole sequence as written (checked before any of it is used, so that a bad file leaves
+	// the list empty)
+	uint64_t const numbases( header.numbases ), namebytes( header.namebytes );
+	bool valid( namebytes % 8 == 0 && header.numsuffixes <= numbases &&
+	            ( header.numsuffixes == 0 || numbases <= std::numeric_limits< uint32_t >::max() ) );
+	for ( uint64_t r(0); r < header.numnruns && valid; ++r ) {
+		valid = nruns[2*r+1] <= numbases && nruns[2*r] <= numbases - nruns[2*r+1];
+	}
+	uint64_t end(0); // of the genes so far
+	for ( uint64_t g(0); g < header.numgenes && valid; ++g ) {
+		uint64_t const offset( genes[3*g] ), size( genes[3*g+1] ), name( genes[3*g+2] );
+		valid = offset == end && size <= numbases - offset &&
+		        name < namebytes && memchr( names + name, '\0', namebytes - name );
+		end = offset + size;
+	}
+	if ( !valid || end != numbases ) {
+		truncated_index( filename );
+		return;
+	}
+
+	sequence_.borrow( words, header.numbases );
+	for ( uint64_t r(0); r < header.numnruns; ++r ) {
+		sequence_.setN( nruns[2*r], nruns[2*r+1] );
+		nruns_.push_back( std::make_pair( nruns[2*r], nruns[2*r+1] ) );
+	}
+	for ( uint64_t g(0); g < header.numgenes; ++g ) {
+		genes_.push_back( Gene( std::string( names + genes[3*g+2] ), &sequence_, genes[3*g] ) );
+		genes_.back().size( genes[3*g+1] );
+	}
+	suffixes_ = reinterpret_cast< uint32_t const * >( names + header.namebytes );
+	numsuffixes_ = header.numsuffixes;
 	finalize();
 }
 
+//// suffixes compare by their first suffixdepth bases, first base most significant
+static uint64_t
+suffix_key( PackedSequence const & sequence, uint64_t index )
+{
+	uint64_t key( __builtin_bswap64( sequence.codes( index ) ) );
+	key = ( ( key >> 4 ) & 0x0F0F0F0F0F0F0F0FULL ) | ( ( key & 0x0F0F0F0F0F0F0F0FULL ) << 4 );
+	key = ( ( key >> 2 ) & 0x3333333333333333ULL ) | ( ( key & 0x3333333333333333ULL ) << 2 );
+	return key;
+}
+
+struct SuffixOrder {
+	SuffixOrder( PackedSequence const & sequence ) : sequence_( sequence ) {}
+	bool operator () ( uint32_t a, uint32_t b ) const
+	{
+		return suffix_key( sequence_, a ) < suffix_key( sequence_, b );
+	}
+	PackedSequence const & sequence_;
+};
+
+bool
+GeneList::build_suffixes()
+{
+	if ( sequence_.size() > std::numeric_limits< uint32_t >::max() ) {
+		if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: sequence too long for a suffix array (4 Gbp at most)" << std::endl;
+		return false;
+	}
+	uint64_t const firstbases( ( uint64_t(1) << suffixdepth ) - 1 );
+	suffixbuffer_.clear();
+	for ( uint64_t i(0), size( sequence_.size() ); i < size; ++i ) {
+		if ( !( sequence_.nbits(i) & firstbases ) ) suffixbuffer_.push_back( i );
+	}
+	std::sort( suffixbuffer_.begin(), suffixbuffer_.end(), SuffixOrder( sequence_ ) );
+	suffixes_ = suffixbuffer_.empty() ? 0 : &suffixbuffer_[0];
+	numsuffixes_ = suffixbuffer_.size();
+	nruns_ = sequence_.nruns();
+	return true;
+}
+
 void
 GeneList::print( std::ostream & out ) const
 {
@@ -130,3 +786,104 @@ std::ostream & operator << ( std::ostream & out, GeneList const & genelist )
 	return out;
 }
 
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// incremental FASTA reader
+FastaStream::FastaStream(
+	std::string const & filename,
+	OutputLevel level // = NORMAL
+)
+	: file_(0),
+		buffer_( 1 << 20 ),
+		pos_(0),
+		end_(0),
+		linestart_(true),
+		bases_(0),
+		outputlevel_( level )
+{
+	if ( filename != "-" ) file_ = gzopen( filename.c_str(), "rb" );
+	else {
+		// (stdin is duplicated, to be left open when the stream is closed)
+		int const fd( dup(0) );
+		if ( fd >= 0 && !( file_ = gzdopen( fd, "rb" ) ) ) close( fd );
+	}
+	if ( file_ ) gzbuffer( file_, 1 << 17 );
+}
+
+FastaStream::~FastaStream()
+{
+	if ( file_ ) gzclose( file_ );
+}
+
+bool
+FastaStream::fill()
+{
+	if ( pos_ < end_ ) return true;
+	if ( !file_ ) return false;
+	int const got( gzread( file_, &buffer_[0], buffer_.size() ) );
+	pos_ = 0;
+	end_ = got > 0 ? got : 0;
+	int status( Z_OK );
+	if ( got <= 0 ) gzerror( file_, &status );
+	if ( status != Z_OK ) {
+		// (such as a truncated or corrupt gzip file: the text read up to there has been handed out)
+		error_ = gzerror( file_, &status );
+		gzclose( file_ );
+		file_ = 0;
+	}
+	return end_ > 0;
+}
+
+bool
+FastaStream::next_record( std::string & name )
+{
+	// skip anything up to the next header line (such as unread bases of the previous record)
+	while ( fill() ) {
+		char const c( buffer_[pos_++] );
+		if ( linestart_ && c == '>' ) {
+			name_.assign( 1, c );
+			// the header line may span several buffers
+			while ( fill() ) {
+				char const * eol( static_cast< char const * >( memchr( &buffer_[pos_], '\n', end_ - pos_ ) ) );
+				if ( !eol ) { name_.append( &buffer_[pos_], end_ - pos_ ); pos_ = end_; continue; }
+				name_.append( &buffer_[pos_], eol - &buffer_[pos_] );
+				pos_ = eol - &buffer_[0] + 1;
+				break;
+			}
+			linestart_ = true;
+			bases_ = 0;
+			bad_ = BadLetters();
+			name = name_;
+			return true;
+		}
+		linestart_ = ( c == '\n' );
+	}
+	return false;
+}
+
+bool
+FastaStream::read_bases(
+	PackedSequence & seq,
+	uint64_t maxsize
+)
+{
+	while ( seq.size() < maxsize ) {
+		if ( !fill() || ( linestart_ && buffer_[pos_] == '>' ) ) {
+			// end of the record
+			if ( outputlevel_ >= MINIMAL ) bad_.report( name_ );
+			bad_ = BadLetters();
+			return false;
+		}
+		// the buffered text up to the next header
+		char const * const text( &buffer_[pos_] ), * const end( &buffer_[0] + end_ );
+		char const * const next( next_header( text, text + 1, end ) );
+		uint64_t const size( seq.size() );
+		BadLetters bad;
+		uint64_t const used( seq.append( text, next - text, bad, maxsize ) );
+		bad_.add( bad, bases_ );
+		bases_ += seq.size() - size;
+		pos_ += used;
+		linestart_ = ( text[ used-1 ] == '\n' );
+	}
+	return true;
+}
@@ -6,41 +6,160 @@
 #define INCLUDED_Sequence
 
 #include <iostream>
+#include <memory> // std::unique_ptr
+#include <string>
+#include <utility> // std::pair
 #include <vector>
+#include <stdint.h> // uint64_t
 
+#include "MappedFile.h"
 #include "util.h"
 
+struct gzFile_s; // zlib
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// letters found in sequence text that are neither nucleotides nor whitespace (they are skipped)
+struct BadLetters {
+	BadLetters() : count(0), first(0), position(0) {}
+
+	// those of a later stretch of the same sequence, starting offset bases further on
+	void add( BadLetters const & later, uint64_t offset );
+	// a single warning for the whole sequence (if there were any)
+	void report( std::string const & name ) const;
+
+	uint64_t count;
+	char first; // the first of them
+	uint64_t position; // number of bases before it
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// 2-bit packed nucleotide storage (A=0, C=1, G=2, T=3), with a side bit mask flagging N
+/// base i lives in bits 2*(i%32) of word i/32, so consecutive bases read out low bits first
+/// the words may also be borrowed from elsewhere (such as a mapped binary genome file)
+class PackedSequence {
+
+	public:
+		PackedSequence() : words_(2,0), nmask_(2,0), data_( &words_[0] ), size_(0) {}
+		PackedSequence( PackedSequence const & other );
+		PackedSequence & operator = ( PackedSequence const & other );
+
+		void push_back( char nucleotide );
+		// grow to size bases, the new ones reading 'A' until packed
+		void resize( uint64_t size );
+		// sequence text is read 32 characters at a time: nucleotides are packed, whitespace (such as
+		// line ends) is skipped, and anything else is skipped and counted in bad
+		// number of nucleotides in text
+		static uint64_t count( char const * text, uint64_t length, BadLetters & bad );
+		// pack the nucleotides of text as bases [index, ...), returning how many there were; disjoint
+		// ranges of bases may be packed by different threads at once
+		uint64_t pack( uint64_t index, char const * text, uint64_t length, BadLetters & bad );
+		// append the nucleotides of text, stopping once there are maxsize bases; returns the number of
+		// characters of text read
+		uint64_t append( char const * text, uint64_t length, BadLetters & bad,
+		                 uint64_t maxsize = ~uint64_t(0) );
+		// use size bases packed elsewhere, in the same layout and with the trailing zero word; the
+		// words must outlive this sequence, which is read-only until clear(); N flags start out clear
+		void borrow( uint64_t const * words, uint64_t size );
+		// flag count bases starting at index as N
+		void setN( uint64_t index, uint64_t count );
+		// the runs of N, as (start, count) in order; stretches without any are skipped 64 bases at a time
+		std::vector< std::pair< uint64_t, uint64_t > > nruns() const;
+		void reserve( uint64_t size );
+		void shrink();
+		void clear();
+		// drop all but the last count bases
+		void keep_tail( uint64_t count );
+
+		uint64_t size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+		// the packed words, including the trailing zero word
+		uint64_t const * words() const { return data_; }
+		uint64_t numwords() const { return ( size_ >> 5 ) + 2; }
+
+		// 2-bit code for base at index
+		unsigned code( uint64_t index ) const
+		{
+			return ( data_[ index >> 5 ] >> ( ( index & 31 ) << 1 ) ) & 3;
+		}
+		bool isN( uint64_t index ) const
+		{
+			return ( nmask_[ index >> 6 ] >> ( index & 63 ) ) & 1;
+		}
+		char base( uint64_t index ) const;
+
+		// 32 consecutive 2-bit codes starting at index (lowest bits first)
+		uint64_t codes( uint64_t index ) const
+		{
+			uint64_t const w( index >> 5 );
+			unsigned const shift( ( index & 31 ) << 1 );
+			if ( shift == 0 ) return data_[w];
+			return ( data_[w] >> shift ) | ( data_[w+1] << ( 64 - shift ) );
+		}
+		// 64 consecutive N flags starting at index (lowest bit first)
+		uint64_t nbits( uint64_t index ) const
+		{
+			uint64_t const w( index >> 6 );
+			unsigned const shift( index & 63 );
+			if ( shift == 0 ) return nmask_[w];
+			return ( nmask_[w] >> shift ) | ( nmask_[w+1] << ( 64 - shift ) );
+		}
+
+		// whether any of the count bases starting at index is N
+		bool anyN( uint64_t index, uint64_t count ) const
+		{
+			for ( ; count >= 64; index += 64, count -= 64 ) if ( nbits( index ) ) return true;
+			return count && ( nbits( index ) & ( ( uint64_t(1) << count ) - 1 ) );
+		}
+
+	private:
+		// both vectors carry one trailing zero word so that codes()/nbits() may read one word ahead
+		std::vector< uint64_t > words_;
+		std::vector< uint64_t > nmask_;
+		uint64_t const * data_; // words_, or borrowed words
+		uint64_t size_;
+};
+
+// decoded output of a packed sequence
+std::ostream & operator << ( std::ostream & out, PackedSequence const & seq );
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
+/// one FASTA record: a named view into the sequence buffer shared by its GeneList
 class Gene {
 
 	public:
 		//// constructors
 		Gene()
-			: finalized_(false)
+			: sequence_(0),
+				offset_(0),
+				size_(0)
 		{}
 
-		Gene( std::string const & name ) { name_.assign( name ); finalized_ = false; }
+		Gene( std::string const & name, PackedSequence const * sequence, uint64_t offset )
+			: sequence_( sequence ),
+				name_( name ),
+				offset_( offset ),
+				size_(0)
+		{}
 
-		std::vector< char > const & sequence() const { return sequence_; }
+		// the whole shared buffer: this gene's bases are [offset(), offset()+size())
+		PackedSequence const & sequence() const { return *sequence_; }
+		uint64_t offset() const { return offset_; }
 		std::string const & name() const { return name_; }
-		void readline( std::string const & line);
 
-		// iterators to provide read access to the gene sequence
-		std::vector< char >::const_iterator begin() const { return sequence_.begin(); }
-		std::vector< char >::const_iterator end() const { return sequence_.end(); }
+		// read access to the (upper-case) gene sequence
+		char base( uint64_t index ) const { return sequence_->base( offset_ + index ); }
+		std::vector< char > site( uint64_t start, unsigned length ) const;
 
-		unsigned size() const { return sequence_.size(); }
-
-		void finalize();
+		uint64_t size() const { return size_; }
+		void size( uint64_t value ) { size_ = value; }
 
 		//// abbreviated summary of the gene sequence
 		void print( std::ostream & out = std::cout ) const;
 
 	private:
-		// try to make this data private...
-		std::vector< char > sequence_; // the meat
+		PackedSequence const * sequence_; // the meat (owned by the GeneList)
 		std::string name_;
-		bool finalized_;
+		uint64_t offset_, size_;
 };
 
 // output stream operator for Gene
@@ -48,42 +167,143 @@ std::ostream & operator<< ( std::ostream & out, Gene const & gene );
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 /// container and manager for a list of genes
+/// reads FASTA, or the binary genome files written by write_index, whose packed bases are used
+/// straight from the mapped file
 class GeneList {
 
 	public:
-		GeneList()
-			: numseqs_(0),
+		explicit GeneList( OutputLevel level = NORMAL )
+			: suffixes_(0),
+				numsuffixes_(0),
+				numseqs_(0),
 				numbps_(0),
-				outputlevel_(NORMAL)
+				threads_(1),
+				outputlevel_(level),
+				good_(true)
 		{}
 
-		GeneList( std::string const filename, OutputLevel level = NORMAL )
-			: numseqs_(0),
+		// large FASTA files are parsed (and BGZF files decompressed) by threads threads
+		GeneList( std::string const filename, OutputLevel level = NORMAL, unsigned threads = 1 )
+			: suffixes_(0),
+				numsuffixes_(0),
+				numseqs_(0),
 				numbps_(0),
-				outputlevel_(level)
+				threads_( threads ? threads : 1 ),
+				outputlevel_(level),
+				good_(true)
 		{
 			readfile( filename );
 		}
 
-		unsigned numseqs() const { return numseqs_; }
-		unsigned numbps() const { return numbps_; }
+		// false if the file given to the constructor could not be read (the list is then empty or
+		// holds only what was read)
+		bool good() const { return good_; }
+
+		// number of threads read_fasta parses large texts with
+		void threads( unsigned value ) { threads_ = value ? value : 1; }
+
+		uint64_t numseqs() const { return numseqs_; }
+		uint64_t numbps() const { return numbps_; }
 		// iterators to provide read access to the gene sequence list
 		std::vector< Gene >::const_iterator begin() const { return genes_.begin(); }
 		std::vector< Gene >::const_iterator end() const { return genes_.end(); }
+		Gene const & gene( unsigned index ) const { return genes_[index]; }
 		void print( std::ostream & out = std::cout ) const;
 
+		// sequences from memory (such as a caller's buffers), added to those already listed; the text
+		// is read in place and only the packed bases are kept (not for binary genome files)
+		// FASTA records
+		void read_fasta( char const * text, uint64_t size );
+		// a single sequence of bare letters, without header or line structure
+		void add( std::string const & name, char const * bases, uint64_t size );
+
+		// binary genome file: header, packed bases, N runs, gene offsets and names, then the suffix
+		// array if any (native byte order)
+		// false if the file could not be written
+		bool write_index( std::string const & filename ) const;
+		static bool is_index( std::string const & filename );
+
+		// suffix array over the shared sequence: the start of every window with no N among its first
+		// suffixdepth bases, sorted by those bases (windows may run on into the next gene)
+		static unsigned const suffixdepth = 32;
+		// false if the sequence is too long (4 Gbp at most)
+		bool build_suffixes();
+		uint32_t const * suffixes() const { return suffixes_; }
+		uint64_t numsuffixes() const { return numsuffixes_; }
+		// the runs of N in sequence(), as (start, count), for lists with a suffix array (from the binary
+		// genome file, or found by build_suffixes)
+		std::vector< std::pair< uint64_t, uint64_t > > const & nruns() const { return nruns_; }
+		PackedSequence const & sequence() const { return sequence_; }
+
 	private:
+		// not copyable: genes refer to sequence_
+		GeneList( GeneList const & );
+		GeneList & operator = ( GeneList const & );
+
 		void finalize();
+		// read_fasta on threads_ threads, record by record and in pieces of long records
+		void read_pieces( char const * text, uint64_t size );
 
-		//// opens the input file and feeds lines to the Gene class
+		//// maps the input file and indexes/packs its records in one pass
 		void readfile( std::string const filename );
+		void read_index( std::string const & filename );
+		void truncated_index( std::string const & filename );
 
 	private:
+		std::unique_ptr< MappedFile > index_; // binary genome file in use
+		PackedSequence sequence_; // all genes, back to back
 		std::vector< Gene > genes_;
-		unsigned numseqs_, numbps_;
+		std::vector< uint32_t > suffixbuffer_; // suffix array built here (rather than mapped)
+		uint32_t const * suffixes_;
+		uint64_t numsuffixes_;
+		std::vector< std::pair< uint64_t, uint64_t > > nruns_;
+		uint64_t numseqs_, numbps_;
+		unsigned threads_;
 		OutputLevel outputlevel_;
+		bool good_;
 };
 
 std::ostream & operator << ( std::ostream & out, GeneList const & genelist );
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// incremental FASTA reader for searches in bounded memory: records are handed out a block of bases
+/// at a time, so memory use does not depend on file or record size
+/// reads plain files, pipes and stdin ("-"), gzip-compressed or not
+class FastaStream {
+
+	public:
+		// unrecognized letters are reported at level MINIMAL and above
+		FastaStream( std::string const & filename, OutputLevel level = NORMAL );
+		~FastaStream();
+
+		bool good() const { return file_ != 0; }
+		// why reading stopped before the end of input (empty if it did not)
+		std::string const & error() const { return error_; }
+
+		// skip to the next record and read its header; false at end of input
+		bool next_record( std::string & name );
+		// append bases of the current record to seq until it holds maxsize bases
+		// returns false once the record is exhausted
+		bool read_bases( PackedSequence & seq, uint64_t maxsize );
+
+	private:
+		// not copyable
+		FastaStream( FastaStream const & );
+		FastaStream & operator = ( FastaStream const & );
+
+		// refill the text buffer once it has been used up; false at end of input (or at a read error)
+		bool fill();
+
+	private:
+		gzFile_s * file_; // (reads uncompressed input as it is)
+		std::vector< char > buffer_;
+		size_t pos_, end_;
+		bool linestart_;
+		std::string name_;
+		uint64_t bases_; // read so far from the current record
+		BadLetters bad_; // of the current record, reported at its end
+		OutputLevel outputlevel_;
+		std::string error_;
+};
+
 #endif
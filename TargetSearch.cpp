@@ -2,131 +2,922 @@
 // Justin Ashworth 2007
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm> // std::min, std::reverse, std::transform
+#include <cmath> // fabs, std::isfinite
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory> // std::unique_ptr
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "util.h"
 #include "TargetSearch.h"
+#include "TaskScheduler.h"
+
+// genes are numbered with the 32-bit indices kept in each Hit
+static uint64_t const maxgenes( std::numeric_limits< unsigned >::max() );
 
 TargetSearch::TargetSearch(
-	std::string const & pssm,
+	std::vector< std::string > const & pssms,
 	unsigned maxhits,
 	bool simple_target,
 	bool invert_pssm,
 	OutputLevel outputlevel // = NORMAL
 )
-	: numseqs_(0),
+	: matrices_( pssms.size() ),
+		maxlength_(0),
+		numseqs_(0),
 		numbps_(0),
+		threads_(1),
+		warmstart_(false),
+		suffixarray_(false),
+		seedlength_(0),
+		prefetch_(1),
 		outputlevel_(outputlevel)
 {
-	if(simple_target) pssm_.setup(pssm);
-	else pssm_.setup( pssm.c_str(), invert_pssm, outputlevel );
-	hits_.maxhits( maxhits );
-	hits_.outputlevel( outputlevel );
+	for ( unsigned m(0); m < pssms.size(); ++m ) {
+		MatrixSearch & matrix( matrices_[m] );
+		matrix.name = pssms[m];
+		bool const loaded( simple_target ? matrix.pssm.setup( pssms[m], outputlevel )
+		                                 : matrix.pssm.setup( pssms[m], invert_pssm, outputlevel ) );
+		if ( !loaded ) {
+			// (nothing is searched for)
+			error_ = matrix.pssm.error();
+			matrices_.clear();
+			maxlength_ = 0;
+			return;
+		}
+		matrix.scorer = WindowScorer( matrix.pssm );
+		matrix.hits.maxhits( maxhits );
+		matrix.hits.outputlevel( outputlevel );
+		maxlength_ = std::max( maxlength_, matrix.pssm.length() );
+	}
+}
+
+void
+TargetSearch::maxscore( float value )
+{
+	for ( unsigned m(0); m < matrices_.size(); ++m ) maxscore( m, value );
 }
 
 void
+TargetSearch::pvalue(
+	double value,
+	std::vector< double > const & background
+)
+{
+	for ( unsigned m(0); m < matrices_.size(); ++m ) pvalue( m, value, background );
+}
+
+void
+TargetSearch::maxhits( unsigned matrix, unsigned value )
+{
+	matrices_[ matrix ].hits.maxhits( value );
+}
+
+void
+TargetSearch::maxscore( unsigned matrix, float value )
+{
+	matrices_[ matrix ].hits.maxscore( value );
+}
+
+//// each matrix gets the score cutoff of its own score distribution
+void
+TargetSearch::pvalue(
+	unsigned matrix,
+	double value,
+	std::vector< double > const & background
+)
+{
+	MatrixSearch & search( matrices_[ matrix ] );
+	float const cutoff( search.pssm.pvalue_cutoff( value, background ) );
+	if ( outputlevel_ >= NORMAL ) {
+		std::cout << "p-value " << value << " is a score cutoff of " << cutoff
+		          << " for " << search.name << std::endl;
+	}
+	search.hits.maxscore( cutoff );
+}
+
+bool
 TargetSearch::scan_seq( std::string const & filename )
 {
-	GeneList genelist( filename, outputlevel_ );
+	GeneList genelist( filename, outputlevel_, threads_ );
+	return scan_genes( genelist ) && genelist.good();
+}
+
+//// a reader thread loads the files into a queue that the searching thread takes them from; the
+//// reader waits while prefetch_ files are queued, so no more than prefetch_+1 files are ever held
+//// the "Reading" notice of each file is printed as it comes to be searched, so that output is in
+//// the same order as when reading and searching in turn (warnings come as the file is read)
+bool
+TargetSearch::scan_files( std::vector< std::string > const & filenames )
+{
+	bool good( true );
+	if ( prefetch_ == 0 || filenames.size() < 2 ) {
+		for ( std::vector< std::string >::const_iterator name( filenames.begin() ); name != filenames.end(); ++name ) {
+			good = scan_seq( *name ) && good;
+		}
+		return good;
+	}
+
+	std::deque< std::unique_ptr< GeneList > > queue;
+	std::mutex mutex;
+	std::condition_variable changed;
+	OutputLevel const readlevel( std::min( outputlevel_, MINIMAL ) );
+	std::thread reader( [&]() {
+		for ( unsigned f(0); f < filenames.size(); ++f ) {
+			{
+				std::unique_lock< std::mutex > lock( mutex );
+				changed.wait( lock, [&]() { return queue.size() < prefetch_; } );
+			}
+			std::unique_ptr< GeneList > genelist( new GeneList( filenames[f], readlevel, threads_ ) );
+			std::lock_guard< std::mutex > lock( mutex );
+			queue.push_back( std::move( genelist ) );
+			changed.notify_all();
+		}
+	} );
+
+	for ( unsigned f(0); f < filenames.size(); ++f ) {
+		std::unique_ptr< GeneList > genelist;
+		{
+			std::unique_lock< std::mutex > lock( mutex );
+			changed.wait( lock, [&]() { return !queue.empty(); } );
+			genelist = std::move( queue.front() );
+			queue.pop_front();
+			changed.notify_all();
+		}
+		if ( outputlevel_ >= NORMAL ) {
+			std::cout << "\nReading " << ( GeneList::is_index( filenames[f] ) ? "binary genome" : "sequence" )
+			          << " file " << filenames[f] << std::endl;
+		}
+		good = scan_genes( *genelist ) && genelist->good() && good;
+	}
+	reader.join();
+	return good;
+}
+
+bool
+TargetSearch::scan_genes( GeneList const & genelist )
+{
+	if ( genelist.numseqs() > maxgenes - numseqs_ ) {
+		if ( outputlevel_ >= MINIMAL ) {
+			std::cerr << "ERROR: too many sequences for one search (" << maxgenes << " at most), skipping "
+			          << genelist.numseqs() << std::endl;
+		}
+		return false;
+	}
+	// genes are numbered in search order over all files, for stable ranking of tied hits
+	unsigned const firstgene( numseqs_ );
+	unsigned geneindex( firstgene );
 	numseqs_ += genelist.numseqs();
 	numbps_ += genelist.numbps();
+	std::vector< Gene const * > views;
+	for ( std::vector< Gene >::const_iterator gene( genelist.begin() ); gene != genelist.end(); ++gene ) {
+		views.push_back( &*gene );
+	}
+	if ( warmstart_ ) warm_start( views, firstgene );
+
+	if ( suffixarray_ ) {
+		if ( genelist.numsuffixes() ) {
+			for ( std::vector< Gene >::const_iterator gene( genelist.begin() ); gene != genelist.end(); ++gene ) {
+				genenames_.push_back( gene->name() );
+			}
+			scan_suffixes( genelist, firstgene );
+			record_sites( views, firstgene, 0 );
+			return true;
+		}
+		if ( outputlevel_ >= MINIMAL ) {
+			std::cerr << "WARNING: no suffix array for sequence file, searching linearly" << std::endl;
+		}
+	}
+
+	// all genes are scheduled together: threads stay busy over any mix of gene sizes
+	if ( threads_ > 1 ) {
+		for ( std::vector< Gene >::const_iterator gene( genelist.begin() ); gene != genelist.end(); ++gene ) {
+			genenames_.push_back( gene->name() );
+			if ( gene->size() > 0 ) announce( *gene );
+			else if ( outputlevel_ >= MINIMAL ) std::cerr << "WARNING: Skipping empty sequence " << gene->name() << std::endl;
+		}
+		scan_tasks( views, firstgene, 0, std::numeric_limits< uint64_t >::max() );
+		record_sites( views, firstgene, 0 );
+		return true;
+	}
+
 	for ( std::vector< Gene >::const_iterator gene( genelist.begin() );
-	      gene != genelist.end(); ++gene ) {
+	      gene != genelist.end(); ++gene, ++geneindex ) {
+		genenames_.push_back( gene->name() );
 		// safety check: if sequence length is zero for some reason, warn and skip searching
 		if (gene->size() == 0) {
-			std::cerr << "WARNING: Skipping empty sequence " << gene->name() << std::endl;
+			if ( outputlevel_ >= MINIMAL ) std::cerr << "WARNING: Skipping empty sequence " << gene->name() << std::endl;
 			continue;
 		}
-		scan_seq( *gene );
+		scan_seq( *gene, geneindex );
+	}
+	record_sites( views, firstgene, 0 );
+	return true;
+}
+
+//// the file is read in blocks of a fixed number of bases; the last maxlength-1 bases of each block
+//// are carried into the next one, so that every window of a sequence is searched exactly once
+bool
+TargetSearch::scan_stream( std::string const & filename )
+{
+	// binary genome files are mapped, not read: they take no memory to speak of as it is
+	if ( GeneList::is_index( filename ) ) return scan_seq( filename );
+	if ( outputlevel_ >= NORMAL ) std::cout << "\nStreaming sequence file " << filename << std::endl;
+	FastaStream stream( filename, outputlevel_ );
+	if ( !stream.good() ) {
+		if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: unable to open sequence file " << filename << std::endl;
+		return false;
+	}
+
+	uint64_t const blockbases( std::max< uint64_t >( 1 << 24, maxlength_ ) );
+	uint64_t const carry( maxlength_ - 1 );
+	PackedSequence block;
+	block.reserve( blockbases );
+
+	std::string name;
+	while ( stream.next_record( name ) ) {
+		if ( numseqs_ == maxgenes ) {
+			if ( outputlevel_ >= MINIMAL ) {
+				std::cerr << "ERROR: too many sequences for one search (" << maxgenes << " at most), stopping at "
+				          << name << std::endl;
+			}
+			return false;
+		}
+		unsigned const geneindex( numseqs_++ );
+		genenames_.push_back( name );
+		block.clear();
+		uint64_t origin(0); // gene position of the first base in block
+		bool more( true );
+		while ( more ) {
+			uint64_t const carried( block.size() );
+			more = stream.read_bases( block, blockbases );
+			numbps_ += block.size() - carried;
+
+			Gene view( name, &block, 0 );
+			view.size( block.size() );
+			if ( origin == 0 && !more && block.size() == 0 ) {
+				if ( outputlevel_ >= MINIMAL ) std::cerr << "WARNING: Skipping empty sequence " << name << std::endl;
+				break;
+			}
+			// windows starting in the carried bases are searched with the next block
+			uint64_t const maxstart( more ? block.size() - carry : block.size() );
+			// a record held in one block is announced whole, as when it is loaded
+			if ( origin == 0 && !more ) announce( view );
+			if ( warmstart_ ) warm_start( std::vector< Gene const * >( 1, &view ), geneindex );
+			scan_seq( view, geneindex, origin, maxstart );
+			record_sites( std::vector< Gene const * >( 1, &view ), geneindex, origin );
+
+			if ( more ) {
+				origin += block.size() - carry;
+				block.keep_tail( carry );
+			}
+		}
+		// longer records only once their length is known
+		if ( origin > 0 && outputlevel_ >= NORMAL ) {
+			std::cout << "Searched gene " << name.substr( 0, 15 ) << ": (" << origin + block.size() << " bp)"
+			          << std::endl;
+		}
+	}
+	if ( stream.error().empty() ) return true;
+	if ( outputlevel_ >= MINIMAL ) std::cerr << "ERROR: unable to read further from " << stream.error() << std::endl;
+	return false;
+}
+
+//// the best maxhits hits among any windows bound the final list, so windows scoring worse can be
+//// rejected from the start; stripes are spaced over all genes together, so that many short genes
+//// are sampled as well as one long one
+void
+TargetSearch::warm_start(
+	std::vector< Gene const * > const & genes,
+	unsigned firstgene
+)
+{
+	uint64_t const stripe( 1 << 11 ), period( 1 << 15 ); // 1 in 16 windows
+
+	std::vector< HitManager > sample( matrices_.size() );
+	std::vector< HitManager * > hits;
+	for ( unsigned m(0); m < matrices_.size(); ++m ) {
+		if ( matrices_[m].hits.maxhits() == std::numeric_limits< unsigned >::max() ) return; // unbounded
+		sample[m].maxhits( matrices_[m].hits.maxhits() );
+		sample[m].maxscore( matrices_[m].hits.cutoff() );
+		hits.push_back( &sample[m] );
+	}
+	// (passing shared cutoffs also keeps the sampling quiet)
+	std::vector< SharedCutoff > shared( matrices_.size() );
+
+	uint64_t origin(0); // first window of the gene, counting over all genes
+	for ( unsigned g(0); g < genes.size(); ++g ) {
+		uint64_t const size( genes[g]->size() );
+		for ( uint64_t s( origin / period * period ); s < origin + size; s += period ) {
+			uint64_t const first( std::max( s, origin ) ), last( std::min( s + stripe, origin + size ) );
+			if ( first < last ) scan_windows( *genes[g], firstgene + g, 0, first - origin, last - origin, hits, &shared );
+		}
+		origin += size;
+	}
+
+	for ( unsigned m(0); m < matrices_.size(); ++m ) {
+		if ( !sample[m].full() ) continue;
+		if ( outputlevel_ >= VERBOSE ) {
+			std::cout << "Warm start cutoff " << sample[m].worst() << " for " << matrices_[m].name << std::endl;
+		}
+		matrices_[m].hits.bound( sample[m].worst() );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// depth-first search of the suffix array for one matrix on one strand
+/// the suffixes sharing the first d bases are a range of the array: the tree of ranges is
+/// descended base by base, best weight first, and a range is dropped as soon as its prefix score
+/// plus the best score of the remaining positions cannot reach the cutoff
+/// the suffixes are read as a block of depth window positions starting at offset: a seed block of
+/// informative positions, or simply the start of the window
+struct SuffixWalk {
+	PackedSequence const * sequence;
+	uint32_t const * suffixes;
+	std::vector< uint64_t > starts, ends; // gene bounds in the shared sequence
+	unsigned firstgene;
+	unsigned length; // matrix length
+	unsigned offset, depth; // block of window positions read from the suffixes
+	// windows with an N among the suffixdepth bases from any of these offsets are searched linearly
+	std::vector< unsigned > linear;
+	std::vector< float > weights; // 4 per window position, by base code
+	std::vector< float > rest; // best score of block positions [d, depth) and all outside the block
+	WindowScorer const * scorer;
+	HitManager * hits;
+	bool rvs;
+};
+
+//// windows of a range are scored in full, in the usual order (so scores are exactly as when
+//// searching linearly)
+static void
+score_suffixes( SuffixWalk const & walk, uint64_t lo, uint64_t hi )
+{
+	uint64_t const firstbases( ( uint64_t(1) << GeneList::suffixdepth ) - 1 );
+	for ( uint64_t i( lo ); i < hi; ++i ) {
+		// (entries past the sequence are only found in a corrupt file)
+		if ( walk.suffixes[i] < walk.offset || walk.suffixes[i] >= walk.sequence->size() ) continue;
+		uint64_t const start( walk.suffixes[i] - walk.offset );
+		unsigned const g( std::upper_bound( walk.starts.begin(), walk.starts.end(), start ) - walk.starts.begin() - 1 );
+		if ( start + walk.length > walk.ends[g] ) continue; // runs off its gene
+		bool linear( false );
+		for ( unsigned o(0); o < walk.linear.size(); ++o ) {
+			if ( walk.sequence->nbits( start + walk.linear[o] ) & firstbases ) linear = true;
+		}
+		if ( linear ) continue;
+		float fwd, rvs;
+		walk.scorer->score( *walk.sequence, start, 1, walk.hits->cutoff(), &fwd, &rvs );
+		float const score( walk.rvs ? rvs : fwd );
+		if ( score == WindowScorer::rejected() ) continue;
+		walk.hits->add_hit( score, walk.firstgene + g, start - walk.starts[g], walk.rvs );
+	}
+}
+
+static void
+descend( SuffixWalk const & walk, uint64_t lo, uint64_t hi, unsigned d, float partial )
+{
+	// (prefix scores are summed in a different order than full scores)
+	if ( partial + walk.rest[d] > walk.hits->cutoff() + walk.scorer->slack() ) return;
+	if ( d == walk.depth || hi - lo <= 4 ) {
+		score_suffixes( walk, lo, hi );
+		return;
+	}
+
+	// the range splits into one range per base at position d
+	uint64_t bounds[5] = { lo, 0, 0, 0, hi };
+	for ( unsigned c(1); c < 4; ++c ) {
+		uint64_t first( bounds[c-1] ), count( hi - first );
+		while ( count > 0 ) {
+			uint64_t const step( count / 2 );
+			uint64_t const suffix( walk.suffixes[ first + step ] );
+			// (entries past the sequence, from a corrupt file, are taken to sort last)
+			if ( suffix < walk.sequence->size() && walk.sequence->code( suffix + d ) < c ) {
+				first += step + 1;
+				count -= step + 1;
+			} else count = step;
+		}
+		bounds[c] = first;
+	}
+	float const * const weights( &walk.weights[ 4 * ( walk.offset + d ) ] );
+	unsigned order[4] = { 0, 1, 2, 3 };
+	for ( unsigned i(1); i < 4; ++i ) {
+		for ( unsigned j(i); j > 0 && weights[ order[j] ] < weights[ order[j-1] ]; --j ) std::swap( order[j], order[j-1] );
+	}
+	for ( unsigned i(0); i < 4; ++i ) {
+		unsigned const c( order[i] );
+		if ( bounds[c] < bounds[c+1] ) descend( walk, bounds[c], bounds[c+1], d+1, partial + weights[c] );
+	}
+}
+
+void
+TargetSearch::scan_suffixes(
+	GeneList const & genelist,
+	unsigned firstgene
+)
+{
+	if ( outputlevel_ >= NORMAL ) {
+		std::cout << "Searching suffix array of " << genelist.numsuffixes() << " windows" << std::endl;
+	}
+	PackedSequence const & sequence( genelist.sequence() );
+	unsigned const maxdepth( GeneList::suffixdepth );
+
+	std::vector< uint64_t > starts, ends;
+	for ( uint64_t g(0); g < genelist.numseqs(); ++g ) {
+		starts.push_back( genelist.gene(g).offset() );
+		ends.push_back( genelist.gene(g).offset() + genelist.gene(g).size() );
+	}
+	std::vector< std::pair< uint64_t, uint64_t > > const & nruns( genelist.nruns() );
+
+	char const letters[] = { 'A', 'C', 'G', 'T' };
+	for ( unsigned m(0); m < matrices_.size(); ++m ) {
+		MatrixSearch & matrix( matrices_[m] );
+		unsigned const length( matrix.pssm.length() );
+		if ( length == 0 ) continue;
+		// the block of window positions read from the suffixes, on each strand
+		unsigned const depth( std::min( length, seedlength_ ? std::min( seedlength_, maxdepth ) : maxdepth ) );
+		unsigned const offset( seedlength_ ? matrix.pssm.seed_offset( depth ) : 0 );
+		std::vector< unsigned > offsets;
+		offsets.push_back( offset );
+		offsets.push_back( seedlength_ ? length - offset - depth : 0 );
+
+		// windows whose block starts a suffix left out of the array (for an N among its first
+		// suffixdepth bases) are searched linearly, on both strands: one range of them per run of N
+		// and distinct offset
+		std::vector< std::pair< uint64_t, uint64_t > > ranges;
+		for ( std::vector< std::pair< uint64_t, uint64_t > >::const_iterator n( nruns.begin() ); n != nruns.end(); ++n ) {
+			for ( unsigned o(0); o < offsets.size(); ++o ) {
+				if ( o > 0 && offsets[o] == offsets[0] ) continue;
+				uint64_t const end( n->first + n->second ); // past the run
+				if ( end <= offsets[o] ) continue;
+				uint64_t const last( end - offsets[o] );
+				uint64_t const span( n->second + maxdepth - 1 ); // blocks overlapping the run
+				ranges.push_back( std::make_pair( last < span ? 0 : last - span, last ) );
+			}
+		}
+		std::sort( ranges.begin(), ranges.end() );
+		std::vector< HitManager * > hits( matrices_.size(), (HitManager*)0 );
+		hits[m] = &matrix.hits;
+		uint64_t scanned(0); // windows before this have been searched
+		for ( std::vector< std::pair< uint64_t, uint64_t > >::const_iterator r( ranges.begin() ); r != ranges.end(); ++r ) {
+			uint64_t const first( std::max( r->first, scanned ) );
+			if ( first >= r->second ) continue;
+			for ( unsigned g(0); g < starts.size(); ++g ) {
+				uint64_t const gfirst( std::max( first, starts[g] ) ), glast( std::min( r->second, ends[g] ) );
+				if ( gfirst < glast ) {
+					scan_windows( genelist.gene(g), firstgene + g, 0, gfirst - starts[g], glast - starts[g], hits );
+				}
+			}
+			scanned = std::max( scanned, r->second );
+		}
+
+		for ( unsigned strand(0); strand < 2; ++strand ) {
+			SuffixWalk walk;
+			walk.sequence = &sequence;
+			walk.suffixes = genelist.suffixes();
+			walk.starts = starts;
+			walk.ends = ends;
+			walk.firstgene = firstgene;
+			walk.length = length;
+			walk.offset = offsets[strand];
+			walk.depth = depth;
+			walk.linear = offsets;
+			walk.weights.resize( 4 * length );
+			float outside(0.);
+			std::vector< float > best( length );
+			for ( unsigned i(0); i < length; ++i ) {
+				best[i] = std::numeric_limits< float >::infinity();
+				for ( unsigned c(0); c < 4; ++c ) {
+					float const weight( strand ? matrix.pssm.rcscore( i, letters[c] ) : matrix.pssm.score( i, letters[c] ) );
+					walk.weights[ 4*i + c ] = weight;
+					best[i] = std::min( best[i], weight );
+				}
+				if ( i < walk.offset || i >= walk.offset + depth ) outside += best[i];
+			}
+			walk.rest.assign( depth + 1, outside );
+			for ( unsigned d( depth ); d > 0; --d ) walk.rest[d-1] = walk.rest[d] + best[ walk.offset + d-1 ];
+			walk.scorer = &matrix.scorer;
+			walk.hits = &matrix.hits;
+			walk.rvs = strand;
+			descend( walk, 0, genelist.numsuffixes(), 0, 0. );
+		}
+	}
+}
+
+//// hits only hold positions: their sites are copied while the sequence is loaded, keeping just
+//// those still ranked
+void
+TargetSearch::record_sites(
+	std::vector< Gene const * > const & views,
+	unsigned firstgene,
+	uint64_t origin
+)
+{
+	typedef MatrixSearch::SiteMap SiteMap;
+	for ( std::vector< MatrixSearch >::iterator matrix( matrices_.begin() ); matrix != matrices_.end(); ++matrix ) {
+		unsigned const length( matrix->pssm.length() );
+		SiteMap kept;
+		std::vector< Hit > const hits( matrix->hits.hits() );
+		for ( std::vector< Hit >::const_iterator h( hits.begin() ), end( hits.end() ); h != end; ++h ) {
+			std::pair< unsigned, uint64_t > const key( h->geneindex(), h->seqindex() );
+			if ( kept.count( key ) ) continue; // other strand
+			SiteMap::iterator old( matrix->sites.find( key ) );
+			if ( old != matrix->sites.end() ) {
+				kept[ key ].swap( old->second );
+			} else if ( h->geneindex() >= firstgene && h->geneindex() - firstgene < views.size() &&
+			            h->seqindex() >= origin ) {
+				kept[ key ] = views[ h->geneindex() - firstgene ]->site( h->seqindex() - origin, length );
+			}
+		}
+		matrix->sites.swap( kept );
 	}
 }
 
 void
 TargetSearch::print_results( std::ostream & out ) const
 {
-	std::cout << std::endl;
-	std::cout << numseqs_ << " sequences with a total of "
-	          << numbps_ << " basepairs searched." << std::endl;
-//	hits_.print( out ); // basic output of hits with no markup
+	print_results( out, 0, matrices_.size() );
+}
+
+void
+TargetSearch::print_results(
+	std::ostream & out,
+	unsigned first,
+	unsigned count
+) const
+{
+	out << std::endl;
+	out << numseqs_ << " sequences with a total of "
+	    << numbps_ << " basepairs searched." << std::endl;
+	for ( unsigned m( first ); m < first + count; ++m ) {
+		if ( count > 1 ) out << "\nHits for " << matrices_[m].name << ":" << std::endl;
+		print_results( matrices_[m], out );
+	}
+}
+
+void
+TargetSearch::print_results( MatrixSearch const & matrix, std::ostream & out ) const
+{
+//	matrix.hits.print( genenames_, out ); // basic output of hits with no markup
 
 	// more informative output of hits by postponed (re)evaluation
-	std::cout << std::showpoint << std::fixed << std::setprecision(2);
-	for ( std::list< Hit >::const_iterator h( hits_.hits().begin() ), end( hits_.hits().end() );
+	out << std::showpoint << std::fixed << std::setprecision(2);
+	std::vector< Hit > const hits( matrix.hits.hits() );
+	for ( std::vector< Hit >::const_iterator h( hits.begin() ), end( hits.end() );
 	      h != end; ++h ) {
-		std::cout << h->score() << " ";
-		for ( unsigned i(0), size( h->sequence().size() ); i < size; ++i ) {
-			char bp( h->sequence()[i] );
+		out << h->score() << " ";
+		std::vector< char > const site( this->site( matrix, *h ) );
+		for ( unsigned i(0), size( site.size() ); i < size; ++i ) {
+			char bp( site[i] );
 			// the basepair letter is made lowercase if it does not represent the best case
-			if ( pssm_.score(i,bp) > pssm_.bestweight(i) ) bp = lower( bp );
-			std::cout << bp;
+			if ( matrix.pssm.score(i,bp) > matrix.pssm.bestweight(i) ) bp = lower( bp );
+			out << bp;
 		}
-		std::cout << " " << h->source() << " " << h->seqindex();
+		out << " " << genenames_[ h->geneindex() ] << " " << h->seqindex();
 		if ( h->rvs() ) out << " (rvs)";
-		std::cout << std::endl;
+		out << std::endl;
+	}
+	out << std::endl;
+}
+
+void
+TargetSearch::report_results( HitSink & sink ) const
+{
+	for ( std::vector< MatrixSearch >::const_iterator matrix( matrices_.begin() ); matrix != matrices_.end(); ++matrix ) {
+		std::vector< Hit > const hits( matrix->hits.hits() );
+		for ( std::vector< Hit >::const_iterator h( hits.begin() ); h != hits.end(); ++h ) {
+			std::vector< char > const site( this->site( *matrix, *h ) );
+			sink.hit( matrix->name, genenames_[ h->geneindex() ], h->seqindex(), h->rvs(), h->score(),
+			          std::string( site.begin(), site.end() ) );
+		}
+	}
+}
+
+std::vector< char >
+TargetSearch::site(
+	MatrixSearch const & matrix,
+	Hit const & hit
+) const
+{
+	MatrixSearch::SiteMap::const_iterator const found( matrix.sites.find( std::make_pair( hit.geneindex(), hit.seqindex() ) ) );
+	// every hit kept has its site recorded; should one be missing, it reads as unknown bases
+	if ( found == matrix.sites.end() ) return std::vector< char >( matrix.pssm.length(), 'N' );
+	std::vector< char > site( found->second );
+	if ( hit.rvs() ) {
+		std::reverse( site.begin(), site.end() );
+		std::transform( site.begin(), site.end(), site.begin(), comp );
 	}
-	std::cout << std::endl;
+	return site;
 }
 
-void TargetSearch::scan_seq( Gene const & gene )
+void
+TargetSearch::scan_seq(
+	Gene const & gene,
+	unsigned geneindex,
+	uint64_t origin,
+	uint64_t maxstart
+)
+{
+	if ( threads_ > 1 ) {
+		scan_tasks( std::vector< Gene const * >( 1, &gene ), geneindex, origin, maxstart );
+		return;
+	}
+	// (each matrix additionally stops at its own last window)
+	uint64_t const nwindows( std::min( maxstart, gene.size() ) );
+	std::vector< HitManager * > hits;
+	for ( unsigned m(0); m < matrices_.size(); ++m ) hits.push_back( &matrices_[m].hits );
+	scan_windows( gene, geneindex, origin, 0, nwindows, hits );
+}
+
+void
+TargetSearch::announce( Gene const & gene ) const
 {
 	if ( outputlevel_ >= NORMAL ) {
 		std::cout << "Searching gene ";
 		gene.print();
 	}
-
-	std::vector< char > const & sequence( gene.sequence() );
-	unsigned start(0), length( pssm_.length() );
-	if ( sequence.size() < length ) {
+	if ( gene.size() < maxlength_ && outputlevel_ >= MINIMAL ) {
 		std::cerr << "WARNING: sequence " << gene.name() << " shorter than PSSM" << std::endl;
 	}
-	unsigned end( sequence.size() - length );
+}
+
+//// long genes are cut into pieces of taskwindows windows, and short ones grouped into tasks of about
+//// as many; neighbouring pieces share the length-1 bases that windows at the boundary read past the
+//// end of their piece
+//// each thread collects its own best hits, merged afterwards: the ranking (ties included) is the
+//// same as for a serial search, however the tasks were shared out
+//// all threads reject against the best cutoffs found by any of them (or by earlier genes)
+void
+TargetSearch::scan_tasks(
+	std::vector< Gene const * > const & genes,
+	unsigned firstgene,
+	uint64_t origin,
+	uint64_t maxstart
+)
+{
+	struct Piece {
+		unsigned gene; // index into genes
+		uint64_t first, last; // windows
+	};
+	uint64_t const taskwindows( 1 << 18 );
+	std::vector< Piece > pieces;
+	for ( unsigned g(0); g < genes.size(); ++g ) {
+		uint64_t const nwindows( std::min( maxstart, genes[g]->size() ) );
+		for ( uint64_t first(0); first < nwindows; first += taskwindows ) {
+			Piece const piece = { g, first, std::min( first + taskwindows, nwindows ) };
+			pieces.push_back( piece );
+		}
+	}
+
+	unsigned const nmatrices( matrices_.size() );
+	TaskScheduler scheduler( threads_ );
+	std::vector< SharedCutoff > shared( nmatrices );
+	for ( unsigned m(0); m < nmatrices; ++m ) {
+		if ( matrices_[m].hits.full() ) shared[m].lower( matrices_[m].hits.worst() );
+	}
+	std::vector< HitManager > threadhits( scheduler.threads() * nmatrices );
+	std::vector< std::vector< HitManager * > > hits( scheduler.threads() );
+	for ( unsigned t(0); t < scheduler.threads(); ++t ) {
+		for ( unsigned m(0); m < nmatrices; ++m ) {
+			threadhits[ t*nmatrices + m ].maxhits( matrices_[m].hits.maxhits() );
+			threadhits[ t*nmatrices + m ].maxscore( matrices_[m].hits.maxscore() );
+			hits[t].push_back( &threadhits[ t*nmatrices + m ] );
+		}
+	}
+
+	unsigned begin(0);
+	uint64_t windows(0);
+	for ( unsigned p(0); p < pieces.size(); ++p ) {
+		windows += pieces[p].last - pieces[p].first;
+		if ( windows < taskwindows && p + 1 < pieces.size() ) continue;
+		unsigned const end( p + 1 );
+		scheduler.add( [&, begin, end]( unsigned thread ) {
+			for ( unsigned i( begin ); i < end; ++i ) {
+				Piece const & piece( pieces[i] );
+				scan_windows( *genes[ piece.gene ], firstgene + piece.gene, origin, piece.first, piece.last,
+				              hits[ thread ], &shared );
+			}
+		}, windows );
+		begin = end;
+		windows = 0;
+	}
+	scheduler.run();
+
+	for ( unsigned i(0); i < threadhits.size(); ++i ) matrices_[ i % nmatrices ].hits.merge( threadhits[i] );
+}
+
+void
+TargetSearch::scan_windows(
+	Gene const & gene,
+	unsigned geneindex,
+	uint64_t origin,
+	uint64_t first,
+	uint64_t last,
+	std::vector< HitManager * > const & hits,
+	std::vector< SharedCutoff > * shared // = 0
+) const
+{
+	PackedSequence const & sequence( gene.sequence() );
 
 	unsigned const dotfreq( 100000 );
-	if ( outputlevel_ >= VERBOSE ) {
+	bool const dots( outputlevel_ >= VERBOSE && threads_ == 1 && !shared );
+	if ( dots ) {
 		std::cerr << "(Each dot represents " << dotfreq << " basepairs searched.)" << std::endl;
 	}
 
-	while ( start <= end ) {
-		float score(0.), worst( hits_.worst() );
+	// windows are scored a block at a time against the cutoff in effect at the start of the block
+	// (a stale cutoff is only looser: every surviving window is checked again against worst())
+	// windows tying the worst hit are left to the HitManager to rank by position: a thread that steals
+	// work does not search its windows in serial order
+	// all matrices are scored over one block before moving on, while its bases are in cache; blocks
+	// are long enough for each matrix's tables to stay in cache over its part of the block
+	unsigned const blocksize( 1024 );
+	std::vector< float > fwd( blocksize ), rvs( blocksize );
+
+	for ( uint64_t block( first ); block < last; block += blocksize ) {
+		for ( unsigned m(0); m < matrices_.size(); ++m ) {
+			if ( !hits[m] ) continue; // (not searched for here)
+			unsigned const length( matrices_[m].pssm.length() );
+			if ( gene.size() < length ) continue;
+			uint64_t const end( std::min( last, gene.size() - length + 1 ) );
+			if ( block >= end ) continue;
+			unsigned const count( std::min< uint64_t >( blocksize, end - block ) );
 
-//		std::vector<char> dbg( gene.begin()+start, gene.begin()+start+length );
-//		std::cout << dbg << std::endl;
+			HitManager & mhits( *hits[m] );
+			SharedCutoff * mshared( shared ? &(*shared)[m] : 0 );
+			float cutoff( mhits.cutoff() );
+			if ( mshared ) cutoff = std::min( cutoff, mshared->value() );
+			// (most blocks have no windows left at all)
+			if ( !matrices_[m].scorer.score( sequence, gene.offset() + block, count, cutoff, &fwd[0], &rvs[0] ) ) continue;
 
-		// score forward site
-		for ( unsigned p(0); p < length; ++p ) {
-			unsigned i( pssm_.priority(p) ); // pssm position index
-			score += pssm_.score( i, sequence[start+i] );
-			// early rejection
-			if ( hits_.full() && ( score + pssm_.bestcase(p) > worst ) ) break;
-			if ( p == length-1 ) { // last position
-				if ( hits_.full() && score >= worst ) break;
-				std::vector<char> hitseq( gene.begin()+start, gene.begin()+start+length );
-				hits_.add_hit( score, hitseq, gene.name(), start );
+			for ( unsigned w(0); w < count; ++w ) {
+				uint64_t const start( origin + block + w ); // gene position
+				// forward site
+				if ( fwd[w] != WindowScorer::rejected() && ( !mshared || fwd[w] <= mshared->value() ) &&
+				     !( mhits.full() && fwd[w] > mhits.worst() ) ) {
+					mhits.add_hit( fwd[w], geneindex, start );
+					if ( mshared && mhits.full() ) mshared->lower( mhits.worst() );
+				}
+				// reverse complement
+				if ( rvs[w] != WindowScorer::rejected() && ( !mshared || rvs[w] <= mshared->value() ) &&
+				     !( mhits.full() && rvs[w] > mhits.worst() ) ) {
+					mhits.add_hit( rvs[w], geneindex, start, true );
+					if ( mshared && mhits.full() ) mshared->lower( mhits.worst() );
+				}
 			}
 		}
-
-		// score reverse complement
-		// separate from above to take advantage of independent early rejection
-		score = 0.; worst = hits_.worst();
-		for ( unsigned p(0); p < length; ++p ) { // priority index
-			unsigned i( pssm_.priority(p) ); // pssm position index
-			// careful here: give FWD index, but reverse complement base
-			score += pssm_.score( i, comp( sequence[ start+length-i-1 ] ) );
-			if ( hits_.full() && ( score + pssm_.bestcase(p) > worst ) ) break;
-			if ( p == length-1 ) {
-				if ( hits_.full() && score >= worst ) break;
-				std::vector<char> hitseq( gene.begin()+start, gene.begin()+start+length );
-				hits_.add_hit( score, hitseq, gene.name(), start, true );
+		if ( dots ) {
+			for ( uint64_t start( origin + block ); start < origin + std::min( last, block + blocksize ); ++start ) {
+				if ( start % dotfreq == 0 ) std::cerr << ".";
 			}
 		}
+	}
+}
 
-		if ( outputlevel_ >= VERBOSE ) {
-			if ( start % dotfreq == 0 ) std::cerr << ".";
+////////////////////////////////////////////////////////////////////////////////////////////////////
+SearchOptions::SearchOptions()
+	: numhits(20),
+		threads(1),
+		seedlength(0),
+		numhits_given(false),
+		simple_target(false),
+		invert_pssm(false),
+		warmstart(false),
+		suffixarray(false),
+		use_maxscore(false),
+		use_pvalue(false),
+		maxscore(0.),
+		pvalue(0.),
+		background( 4, 0.25 ),
+		outputlevel(NORMAL),
+		bad(false)
+{}
+
+bool
+SearchOptions::parse(
+	std::vector< std::string > const & args,
+	unsigned & i
+)
+{
+	std::string const & arg( args[i] );
+	unsigned const values( args.size() - i - 1 ); // following arguments
+
+	if ( arg == "-p" || arg == "--pssm" ) {
+		if ( values < 1 ) bad = true;
+		else pssms.push_back( args[++i] );
+
+	} else if ( arg == "-P" || arg == "--pssmlist" ) {
+		if ( values < 1 ) bad = true;
+		else pssmlistname = args[++i];
+
+	} else if ( arg == "-t" || arg == "--target" ) {
+		simple_target = true;
+
+	} else if ( arg == "-inv" ) {
+		invert_pssm = true;
+
+	} else if ( arg == "-n" || arg == "--numhits" || arg == "--hits" ) {
+		if ( values < 1 || !read_unsigned( args[++i], numhits ) ) bad = true;
+		numhits_given = true;
+
+	} else if ( arg == "--max-score" ) {
+		double value(0.);
+		if ( values < 1 || !read_double( args[++i], value ) ||
+		     fabs( value ) > std::numeric_limits< float >::max() ) bad = true;
+		else maxscore = value;
+		use_maxscore = true;
+
+	} else if ( arg == "--pvalue" ) {
+		// a fraction of sites: (0, 1]
+		if ( values < 1 || !read_double( args[++i], pvalue ) || !( pvalue > 0. && pvalue <= 1. ) ) bad = true;
+		use_pvalue = true;
+
+	} else if ( arg == "--background" ) {
+		if ( values < 4 ) { bad = true; return true; }
+		// base frequencies of any total: none negative, not all zero
+		bool valid( true );
+		double total(0.);
+		for ( unsigned c(0); c < 4; ++c ) {
+			if ( !read_double( args[++i], background[c] ) || background[c] < 0 ) valid = false;
+			else total += background[c];
 		}
+		if ( !valid || !( total > 0. ) || !std::isfinite( total ) ) bad = true;
+		else for ( unsigned c(0); c < 4; ++c ) background[c] /= total;
+
+	} else if ( arg == "--warm-start" ) {
+		warmstart = true;
+
+	} else if ( arg == "--suffix-array" ) {
+		suffixarray = true;
+
+	} else if ( arg == "--seed" ) {
+		if ( values < 1 || !read_unsigned( args[++i], seedlength ) ) bad = true;
+		suffixarray = true;
+
+	} else if ( arg == "--threads" ) {
+		if ( values < 1 || !read_unsigned( args[++i], threads ) ) bad = true;
+
+	} else if ( arg == "-v" || arg == "--verbose" ) {
+		outputlevel = VERBOSE;
+
+	} else if ( arg == "-m" || arg == "--minimal" || arg == "--mute" ) {
+		outputlevel = MINIMAL;
+
+	} else return false;
+	return true;
+}
 
-		++start;
+//// all matrices are searched for together in one pass
+bool
+SearchOptions::matrices( std::vector< std::string > & list ) const
+{
+	list = pssms;
+	if ( !pssmlistname.empty() ) {
+		std::ifstream pssmlistfile;
+		pssmlistfile.open( pssmlistname.c_str() );
+		if ( !pssmlistfile ) return false;
+		std::string line;
+		while ( getline( pssmlistfile, line ) ) {
+			if ( !line.empty() ) list.push_back( line );
+		}
 	}
+	if ( list.empty() ) list.push_back( "" );
+	return true;
 }
 
+unsigned
+SearchOptions::maxhits() const
+{
+	if ( ( use_maxscore || use_pvalue ) && !numhits_given ) return std::numeric_limits< unsigned >::max();
+	return numhits;
+}
+
+void
+SearchOptions::configure( TargetSearch & search ) const
+{
+	search.threads( threads );
+	search.warmstart( warmstart );
+	search.suffixarray( suffixarray );
+	search.seedlength( seedlength );
+	if ( use_maxscore ) search.maxscore( maxscore );
+	if ( use_pvalue ) search.pvalue( pvalue, background );
+}
+
+void
+SearchOptions::configure(
+	TargetSearch & search,
+	unsigned first,
+	unsigned count
+) const
+{
+	for ( unsigned m( first ); m < first + count; ++m ) {
+		search.maxhits( m, maxhits() );
+		if ( use_maxscore ) search.maxscore( m, maxscore );
+		if ( use_pvalue ) search.pvalue( m, pvalue, background );
+	}
+}
@@ -6,34 +6,159 @@
 #define INCLUDED_TargetSearch
 
 #include <iostream>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "Sequence.h"
 #include "Hits.h"
 #include "PSSM.h"
+#include "WindowScorer.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// one matrix being searched for, with its own best hits
+struct MatrixSearch {
+	std::string name; // filename or target string
+	PSSM pssm;
+	WindowScorer scorer;
+	HitManager hits;
+	// forward-strand sites of current hits by (geneindex, seqindex), for output
+	typedef std::map< std::pair< unsigned, uint64_t >, std::vector< char > > SiteMap;
+	SiteMap sites;
+};
 
 // the highest-level (application) class
+// every window of the sequence is scored against all matrices in a single pass
 class TargetSearch {
 
 	public:
 		TargetSearch(
-			std::string const & pssm,
+			std::vector< std::string > const & pssms,
 			unsigned maxhits,
 			bool simple_target,
 			bool invert_pssm,
 			OutputLevel outputlevel = NORMAL
 		);
 
-		void scan_seq( std::string const & filename );
+		// false if a matrix could not be loaded (see error()): the search then holds no matrices
+		bool good() const { return error_.empty(); }
+		std::string const & error() const { return error_; }
+
+		// number of threads each file is read with (parsing large FASTA files, decompressing BGZF) and
+		// searched with (its genes and pieces of long genes shared out among them)
+		void threads( unsigned value ) { threads_ = value ? value : 1; }
+		// report only hits scoring at or below a fixed cutoff, known before the search starts
+		void maxscore( float value );
+		// the same, with the cutoff passed by a fraction value of random sites of the given
+		// background base composition (A, C, G, T)
+		void pvalue( double value, std::vector< double > const & background );
+		// settings for single matrices (such as those of different queries searched together)
+		void maxhits( unsigned matrix, unsigned value );
+		void maxscore( unsigned matrix, float value );
+		void pvalue( unsigned matrix, double value, std::vector< double > const & background );
+		// sample the input for a tight cutoff before searching all of it
+		void warmstart( bool value ) { warmstart_ = value; }
+		// search binary genome files through their suffix arrays, where they have one
+		void suffixarray( bool value ) { suffixarray_ = value; }
+		// suffix array searches start from the most informative block of this many positions of each
+		// matrix (0: the start of the matrix)
+		void seedlength( unsigned value ) { seedlength_ = value; }
+		// number of files scan_files reads ahead (on another thread) of the one being searched
+		// (0: read each file only once the last has been searched)
+		void prefetch( unsigned value ) { prefetch_ = value; }
+
+		// the scan functions for files return false if one could not be read in full (what was read of
+		// it is searched all the same)
+		bool scan_seq( std::string const & filename );
+		// search files in order, reading the next ones while searching the current one; at most
+		// prefetch files wait in memory to be searched
+		bool scan_files( std::vector< std::string > const & filenames );
+		// search sequences already loaded (such as those kept by a server)
+		// genes are numbered over the whole search by 32-bit indices: false (and nothing searched) if
+		// genelist would take the search past 2^32 - 1 sequences; scan_stream stops there likewise
+		bool scan_genes( GeneList const & genelist );
+		// search a file (or stdin, "-") block by block as it is read, in constant memory
+		bool scan_stream( std::string const & filename );
 		void print_results( std::ostream & out = std::cout ) const;
+		// results for matrices [first, first+count) only, as if they had been searched for alone
+		void print_results( std::ostream & out, unsigned first, unsigned count ) const;
+		// hand the results to sink instead, matrix by matrix in the order they would be printed
+		void report_results( HitSink & sink ) const;
 
 	private: // methods
-		void scan_seq( Gene const & gene );
+		// copy out the sites of current hits in genes [firstgene, firstgene+views.size()) before their
+		// sequence goes away; each view holds its gene's bases from position origin on
+		void record_sites( std::vector< Gene const * > const & views, unsigned firstgene, uint64_t origin );
+		// bound each matrix's cutoff by the best hits among evenly spaced stripes of the genes
+		void warm_start( std::vector< Gene const * > const & genes, unsigned firstgene );
+		// branch and bound over the suffix array, for the windows it holds; the rest (those near N) are
+		// searched linearly
+		void scan_suffixes( GeneList const & genelist, unsigned firstgene );
+		// gene may be part of a longer sequence that starts origin bases earlier
+		// only windows starting before maxstart are searched (the rest are left to the next block)
+		void scan_seq( Gene const & gene, unsigned geneindex, uint64_t origin, uint64_t maxstart );
+		void scan_seq( Gene const & gene, unsigned geneindex )
+		{
+			announce( gene );
+			scan_seq( gene, geneindex, 0, gene.size() );
+		}
+		// "Searching gene" and the short sequence warning, once per gene
+		void announce( Gene const & gene ) const;
+		// search windows starting before maxstart in genes [firstgene, firstgene+genes.size()) on all
+		// threads; genes and pieces of long genes are scheduled as tasks, stolen by idle threads
+		void scan_tasks( std::vector< Gene const * > const & genes, unsigned firstgene, uint64_t origin,
+		                 uint64_t maxstart );
+		// search windows starting at [first, last) of gene, recording hits for matrix m in hits[m]
+		// shared (if any) are the cutoffs pooled with other threads
+		void scan_windows( Gene const & gene, unsigned geneindex, uint64_t origin,
+		                   uint64_t first, uint64_t last, std::vector< HitManager * > const & hits,
+		                   std::vector< SharedCutoff > * shared = 0 ) const;
+		void print_results( MatrixSearch const & matrix, std::ostream & out ) const;
+		// the site of hit, read along its strand
+		std::vector< char > site( MatrixSearch const & matrix, Hit const & hit ) const;
 
 	private: // data
-		HitManager hits_;
-		PSSM pssm_;
-		unsigned numseqs_, numbps_;
+		std::vector< MatrixSearch > matrices_;
+		unsigned maxlength_; // longest matrix
+		// for output: names of all genes searched
+		std::vector< std::string > genenames_;
+		uint64_t numseqs_, numbps_;
+		unsigned threads_;
+		bool warmstart_, suffixarray_;
+		unsigned seedlength_;
+		unsigned prefetch_;
 		OutputLevel outputlevel_;
+		std::string error_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// the settings of one search, as given on the command line (or in a server query)
+struct SearchOptions {
+
+	SearchOptions();
+
+	// reads the option at args[i] and its values, leaving i at the last of them
+	// false if it is not a search option; bad is set if its values are missing or invalid
+	bool parse( std::vector< std::string > const & args, unsigned & i );
+	// matrices given with -p and in the -P file (false if that cannot be read)
+	bool matrices( std::vector< std::string > & list ) const;
+	// with a cutoff, every passing hit is reported (unless a number of hits is also given)
+	unsigned maxhits() const;
+	// apply the settings not given to the TargetSearch constructor
+	void configure( TargetSearch & search ) const;
+	// the same, for matrices [first, first+count) only (settings of the whole search are left alone)
+	void configure( TargetSearch & search, unsigned first, unsigned count ) const;
+
+	std::vector< std::string > pssms;
+	std::string pssmlistname;
+	unsigned numhits, threads, seedlength;
+	bool numhits_given, simple_target, invert_pssm, warmstart, suffixarray;
+	bool use_maxscore, use_pvalue;
+	float maxscore;
+	double pvalue;
+	std::vector< double > background;
+	OutputLevel outputlevel;
+	bool bad;
 };
 
 #endif
@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm> // std::min
+#include <thread>
+
+#include "TaskScheduler.h"
+
+TaskScheduler::TaskScheduler( unsigned threads )
+	: queues_( threads ? threads : 1 )
+{}
+
+void
+TaskScheduler::add(
+	Task const & task,
+	uint64_t cost // = 1
+)
+{
+	tasks_.push_back( task );
+	costs_.push_back( cost );
+}
+
+//// no task adds others, so a thread that finds every deque empty is done
+void
+TaskScheduler::run()
+{
+	unsigned const nthreads( std::min< uint64_t >( queues_.size(), tasks_.size() ) );
+	if ( nthreads == 0 ) return;
+
+	uint64_t total(0);
+	for ( unsigned i(0); i < costs_.size(); ++i ) total += costs_[i];
+	uint64_t done(0);
+	unsigned thread(0);
+	for ( unsigned i(0); i < tasks_.size(); ++i ) {
+		while ( thread + 1 < nthreads && done >= total * ( thread + 1 ) / nthreads ) ++thread;
+		queues_[ thread ].tasks.push_back( i );
+		done += costs_[i];
+	}
+
+	std::vector< std::thread > workers;
+	for ( unsigned t(1); t < nthreads; ++t ) workers.push_back( std::thread( &TaskScheduler::work, this, t ) );
+	work( 0 );
+	for ( unsigned t(0); t < workers.size(); ++t ) workers[t].join();
+
+	tasks_.clear();
+	costs_.clear();
+}
+
+void
+TaskScheduler::work( unsigned thread )
+{
+	unsigned task;
+	while ( take( thread, task ) ) tasks_[ task ]( thread );
+}
+
+bool
+TaskScheduler::take(
+	unsigned thread,
+	unsigned & task
+)
+{
+	{
+		Queue & own( queues_[ thread ] );
+		std::lock_guard< std::mutex > lock( own.mutex );
+		if ( !own.tasks.empty() ) {
+			task = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+	for ( unsigned i(1); i < queues_.size(); ++i ) {
+		Queue & other( queues_[ ( thread + i ) % queues_.size() ] );
+		std::lock_guard< std::mutex > lock( other.mutex );
+		if ( !other.tasks.empty() ) {
+			task = other.tasks.back();
+			other.tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,55 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_TaskScheduler
+#define INCLUDED_TaskScheduler
+
+#include <deque>
+#include <functional> // std::function
+#include <mutex>
+#include <stdint.h> // uint64_t
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// runs tasks of uneven size on a number of threads, keeping every thread busy until the last task
+/// has been taken
+/// each thread starts on its own contiguous share of the tasks (by cost), taking them from the front
+/// of its deque in order; a thread that runs out steals from the back of the other deques, the work
+/// furthest from what their own threads are doing
+class TaskScheduler {
+
+	public:
+		// a task is passed the index of the thread running it, in [0, threads)
+		typedef std::function< void ( unsigned thread ) > Task;
+
+		TaskScheduler( unsigned threads );
+
+		unsigned threads() const { return queues_.size(); }
+
+		// queue a task of about cost units of work
+		void add( Task const & task, uint64_t cost = 1 );
+		// runs all tasks queued, the calling thread being thread 0, and returns once all are done
+		void run();
+
+	private:
+		// not copyable
+		TaskScheduler( TaskScheduler const & );
+		TaskScheduler & operator = ( TaskScheduler const & );
+
+		void work( unsigned thread );
+		// the next task of thread's own deque, else one stolen from another (false if none are left)
+		bool take( unsigned thread, unsigned & task );
+
+	private:
+		struct Queue {
+			std::mutex mutex;
+			std::deque< unsigned > tasks; // indices into tasks_
+		};
+
+		std::vector< Queue > queues_; // one per thread
+		std::vector< Task > tasks_;
+		std::vector< uint64_t > costs_;
+};
+
+#endif
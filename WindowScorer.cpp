@@ -0,0 +1,546 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm> // std::fill
+#include <limits>
+#include <math.h> // fabs
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WINDOWSCORER_X86
+#endif
+
+#include "WindowScorer.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// SIMD kernels: each scores a group of adjacent windows over the same sequence of steps
+#ifdef WINDOWSCORER_X86
+
+//// 8 windows per pass: codes and N flags for 8 adjacent bases are unpacked with variable shifts
+//// and looked up with an in-register permute of the 8 weights of the step
+template < typename Step >
+__attribute__(( target("avx2") ))
+static void
+score8_avx2(
+	PackedSequence const & seq,
+	uint64_t start,
+	float cutoff,
+	Step const * steps,
+	unsigned nsteps,
+	float * out
+)
+{
+	__m256i const shifts( _mm256_setr_epi32( 0, 2, 4, 6, 8, 10, 12, 14 ) );
+	__m256i const lanes( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) );
+	__m256i const three( _mm256_set1_epi32( 3 ) ), four( _mm256_set1_epi32( 4 ) );
+	__m256 const cut( _mm256_set1_ps( cutoff ) );
+	__m256 sum( _mm256_setzero_ps() ), dead( _mm256_setzero_ps() );
+
+	for ( unsigned s(0); s < nsteps; ++s ) {
+		Step const & step( steps[s] );
+		uint64_t const b( start + step.offset );
+		__m256i const codes( _mm256_and_si256( three,
+			_mm256_srlv_epi32( _mm256_set1_epi32( int( seq.codes(b) & 0xFFFF ) ), shifts ) ) );
+		// N flag of lane k lands on bit 2
+		__m256i const nflags( _mm256_and_si256( four,
+			_mm256_srlv_epi32( _mm256_set1_epi32( int( ( seq.nbits(b) & 0xFF ) << 2 ) ), lanes ) ) );
+		__m256i const index( _mm256_or_si256( codes, nflags ) );
+		sum = _mm256_add_ps( sum, _mm256_permutevar8x32_ps( _mm256_loadu_ps( step.weights ), index ) );
+		// early rejection
+		dead = _mm256_or_ps( dead, _mm256_cmp_ps( _mm256_add_ps( sum, _mm256_set1_ps( step.bestcase ) ), cut, _CMP_GT_OQ ) );
+		if ( _mm256_movemask_ps( dead ) == 0xFF ) break;
+	}
+	_mm256_storeu_ps( out, _mm256_blendv_ps( sum, _mm256_set1_ps( WindowScorer::rejected() ), dead ) );
+}
+
+//// 4 windows per pass: weights are looked up per lane, accumulation and rejection are vectorized
+template < typename Step >
+static void
+score4_sse2(
+	PackedSequence const & seq,
+	uint64_t start,
+	float cutoff,
+	Step const * steps,
+	unsigned nsteps,
+	float * out
+)
+{
+	__m128 const cut( _mm_set1_ps( cutoff ) );
+	__m128 sum( _mm_setzero_ps() ), dead( _mm_setzero_ps() );
+
+	for ( unsigned s(0); s < nsteps; ++s ) {
+		Step const & step( steps[s] );
+		uint64_t const b( start + step.offset );
+		unsigned const codes( seq.codes(b) ), n( seq.nbits(b) << 2 );
+		__m128 const w( _mm_setr_ps(
+			step.weights[ ( codes & 3 ) | ( n & 4 ) ],
+			step.weights[ ( ( codes >> 2 ) & 3 ) | ( ( n >> 1 ) & 4 ) ],
+			step.weights[ ( ( codes >> 4 ) & 3 ) | ( ( n >> 2 ) & 4 ) ],
+			step.weights[ ( ( codes >> 6 ) & 3 ) | ( ( n >> 3 ) & 4 ) ] ) );
+		sum = _mm_add_ps( sum, w );
+		// early rejection
+		dead = _mm_or_ps( dead, _mm_cmpgt_ps( _mm_add_ps( sum, _mm_set1_ps( step.bestcase ) ), cut ) );
+		if ( _mm_movemask_ps( dead ) == 0xF ) break;
+	}
+	__m128 const rej( _mm_set1_ps( WindowScorer::rejected() ) );
+	_mm_storeu_ps( out, _mm_or_ps( _mm_and_ps( dead, rej ), _mm_andnot_ps( dead, sum ) ) );
+}
+
+//// block screening of 8 windows: the block index of each lane is gathered straight from the table
+template < typename BlockStep >
+__attribute__(( target("avx2") ))
+static unsigned
+screen8_avx2(
+	PackedSequence const & seq,
+	uint64_t start,
+	float cutoff,
+	BlockStep const * blocks,
+	unsigned nblocks,
+	float const * weights
+)
+{
+	__m256i const shifts( _mm256_setr_epi32( 0, 2, 4, 6, 8, 10, 12, 14 ) );
+	__m256 const cut( _mm256_set1_ps( cutoff ) );
+	__m256 sum( _mm256_setzero_ps() ), dead( _mm256_setzero_ps() );
+
+	for ( unsigned b(0); b < nblocks; ++b ) {
+		BlockStep const & block( blocks[b] );
+		__m256i const index( _mm256_and_si256( _mm256_set1_epi32( block.mask ),
+			_mm256_srlv_epi32( _mm256_set1_epi32( int( seq.codes( start + block.offset ) & 0xFFFFFF ) ), shifts ) ) );
+		sum = _mm256_add_ps( sum, _mm256_i32gather_ps( weights + block.weights, index, 4 ) );
+		dead = _mm256_or_ps( dead, _mm256_cmp_ps( _mm256_add_ps( sum, _mm256_set1_ps( block.bestcase ) ), cut, _CMP_GT_OQ ) );
+		if ( _mm256_movemask_ps( dead ) == 0xFF ) break;
+	}
+	return ~_mm256_movemask_ps( dead ) & 0xFF;
+}
+
+//// mismatch counting for 4 groups of 64 windows, over 4 consecutive words of each bit plane: all
+//// lanes share the offset of each step, so the planes are shifted into place by the same amount
+//// the Bits-bit counters (see count_mismatches) stay in registers; counter and over receive the
+//// 4 groups' words interleaved (counter[4*i + g])
+template < unsigned Bits, typename MatchStep >
+__attribute__(( target("avx2") ))
+static void
+count4_avx2(
+	uint64_t const * lo,
+	uint64_t const * hi,
+	uint64_t const * n,
+	uint64_t start,
+	MatchStep const * steps,
+	unsigned nsteps,
+	uint64_t * counter,
+	uint64_t * over
+)
+{
+	__m256i const ones( _mm256_set1_epi64x( -1 ) );
+	__m256i bits[ Bits ];
+	for ( unsigned i(0); i < Bits; ++i ) bits[i] = ( start >> i ) & 1 ? ones : _mm256_setzero_si256();
+	__m256i overflow( _mm256_setzero_si256() );
+
+	for ( unsigned s(0); s < nsteps; ++s ) {
+		MatchStep const & step( steps[s] );
+		unsigned const w( step.offset >> 6 ), shift( step.offset & 63 );
+		// (a shift by 64 clears the word: no special case for aligned offsets)
+		__m128i const right( _mm_cvtsi32_si128( shift ) ), left( _mm_cvtsi32_si128( 64 - shift ) );
+		__m256i const l( _mm256_or_si256(
+			_mm256_srl_epi64( _mm256_loadu_si256( reinterpret_cast< __m256i const * >( lo + w ) ), right ),
+			_mm256_sll_epi64( _mm256_loadu_si256( reinterpret_cast< __m256i const * >( lo + w + 1 ) ), left ) ) );
+		__m256i const h( _mm256_or_si256(
+			_mm256_srl_epi64( _mm256_loadu_si256( reinterpret_cast< __m256i const * >( hi + w ) ), right ),
+			_mm256_sll_epi64( _mm256_loadu_si256( reinterpret_cast< __m256i const * >( hi + w + 1 ) ), left ) ) );
+		__m256i const nn( _mm256_or_si256(
+			_mm256_srl_epi64( _mm256_loadu_si256( reinterpret_cast< __m256i const * >( n + w ) ), right ),
+			_mm256_sll_epi64( _mm256_loadu_si256( reinterpret_cast< __m256i const * >( n + w + 1 ) ), left ) ) );
+		__m256i const nh( _mm256_xor_si256( h, ones ) ), nl( _mm256_xor_si256( l, ones ) );
+		__m256i const match( _mm256_or_si256(
+			_mm256_or_si256(
+				_mm256_and_si256( _mm256_set1_epi64x( step.matches[0] ), _mm256_and_si256( nh, nl ) ),
+				_mm256_and_si256( _mm256_set1_epi64x( step.matches[1] ), _mm256_and_si256( nh, l ) ) ),
+			_mm256_or_si256(
+				_mm256_and_si256( _mm256_set1_epi64x( step.matches[2] ), _mm256_and_si256( h, nl ) ),
+				_mm256_and_si256( _mm256_set1_epi64x( step.matches[3] ), _mm256_and_si256( h, l ) ) ) ) );
+		// add the mismatches (N included) to the counters
+		__m256i carry( _mm256_or_si256( nn, _mm256_xor_si256( match, ones ) ) );
+		for ( unsigned i(0); i < Bits; ++i ) {
+			__m256i const next( _mm256_and_si256( bits[i], carry ) );
+			bits[i] = _mm256_xor_si256( bits[i], carry );
+			carry = next;
+		}
+		overflow = _mm256_or_si256( overflow, carry );
+		if ( _mm256_testc_si256( overflow, ones ) ) break;
+	}
+	for ( unsigned i(0); i < Bits; ++i ) _mm256_storeu_si256( reinterpret_cast< __m256i * >( counter + 4*i ), bits[i] );
+	_mm256_storeu_si256( reinterpret_cast< __m256i * >( over ), overflow );
+}
+
+#endif
+
+//// scores of the windows that have not overflowed: their number of mismatches is what their
+//// counter has counted up from start (counter bits are stride words apart)
+//// false if there are none
+static bool
+record_mismatches(
+	uint64_t const * counter,
+	unsigned stride,
+	unsigned bits,
+	uint64_t over,
+	unsigned start,
+	unsigned positions,
+	float * out
+)
+{
+	for ( uint64_t alive( ~over ); alive; alive &= alive - 1 ) {
+		unsigned const b( __builtin_ctzll( alive ) );
+		unsigned value(0);
+		for ( unsigned i(0); i < bits; ++i ) value |= ( ( counter[ stride * i ] >> b ) & 1 ) << i;
+		out[b] = float( int( value - start ) - int( positions ) );
+	}
+	return ~over;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+WindowScorer::WindowScorer( PSSM const & pssm )
+	: length_( pssm.length() ),
+		slack_(0.),
+		avx2_( false ),
+		consensus_( false ),
+		weighted_(0),
+		weightedbest_(0.)
+{
+	char const letters[] = { 'A', 'C', 'G', 'T', 'N', 'N', 'N', 'N' };
+	for ( unsigned p(0); p < length_; ++p ) {
+		Step fwd, rvs;
+		fwd.offset = pssm.priority(p);
+		rvs.offset = pssm.rcpriority(p);
+		for ( unsigned c(0); c < 8; ++c ) {
+			fwd.weights[c] = pssm.score( fwd.offset, letters[c] );
+			rvs.weights[c] = pssm.rcscore( rvs.offset, letters[c] );
+		}
+		fwd.bestcase = rvs.bestcase = pssm.bestcase(p);
+		fwdsteps_.push_back( fwd );
+		rvssteps_.push_back( rvs );
+		float bound(0.);
+		for ( unsigned c(0); c < 4; ++c ) bound = std::max( bound, fabsf( fwd.weights[c] ) );
+		slack_ += bound;
+	}
+	// each of the at most 2*length roundings of either sum is off by no more than epsilon times
+	// the largest partial sum
+	slack_ *= 4 * ( length_ + 1 ) * std::numeric_limits< float >::epsilon();
+
+	for ( unsigned strand(0); strand < 2; ++strand ) {
+		std::vector< PssmBlock > const & blocks( strand ? pssm.rcblocks() : pssm.blocks() );
+		for ( std::vector< PssmBlock >::const_iterator block( blocks.begin() ); block != blocks.end(); ++block ) {
+			BlockStep step;
+			step.offset = block->offset;
+			step.mask = ( 1 << ( 2 * block->length ) ) - 1;
+			step.weights = blockweights_.size();
+			step.bestcase = block->bestcase;
+			blockweights_.insert( blockweights_.end(), block->weights.begin(), block->weights.end() );
+			( strand ? rvsblocks_ : fwdblocks_ ).push_back( step );
+		}
+	}
+#ifdef WINDOWSCORER_X86
+	avx2_ = __builtin_cpu_supports("avx2");
+#endif
+
+	// consensus positions contribute minus their number of matches (N never matches); mismatch counting
+	// pays off once they are most of the matrix
+	for ( unsigned p(0); p < length_; ++p ) {
+		if ( pssm.consensus( fwdsteps_[p].offset ) < 0 ) {
+			++weighted_;
+			weightedbest_ += *std::min_element( fwdsteps_[p].weights, fwdsteps_[p].weights + 5 );
+			continue;
+		}
+		unsigned const accepted( pssm.consensus( fwdsteps_[p].offset ) );
+		MatchStep fwd, rvs;
+		fwd.offset = fwdsteps_[p].offset;
+		rvs.offset = rvssteps_[p].offset;
+		for ( unsigned c(0); c < 4; ++c ) {
+			fwd.matches[c] = ( accepted >> c ) & 1 ? ~uint64_t(0) : 0;
+			// (the reverse strand accepts the complement, which has the reversed code)
+			rvs.matches[c] = ( accepted >> ( 3 - c ) ) & 1 ? ~uint64_t(0) : 0;
+		}
+		fwdmatches_.push_back( fwd );
+		rvsmatches_.push_back( rvs );
+	}
+	// (counters are at most 8 bits wide)
+	consensus_ = length_ > 0 && 4 * weighted_ <= length_ && fwdmatches_.size() < 256;
+}
+
+//// reference implementation for a single window, identical in arithmetic to the SIMD kernels
+void
+WindowScorer::score_scalar(
+	PackedSequence const & seq,
+	uint64_t start,
+	float cutoff,
+	std::vector< Step > const & steps,
+	float * out
+) const
+{
+	float score(0.);
+	for ( std::vector< Step >::const_iterator step( steps.begin() ); step != steps.end(); ++step ) {
+		uint64_t const b( start + step->offset );
+		score += step->weights[ seq.code(b) | ( seq.isN(b) << 2 ) ];
+		// early rejection
+		if ( score + step->bestcase > cutoff ) { *out = rejected(); return; }
+	}
+	*out = score;
+}
+
+//// true unless the window cannot score <= cutoff
+bool
+WindowScorer::screen_scalar(
+	PackedSequence const & seq,
+	uint64_t start,
+	float cutoff,
+	std::vector< BlockStep > const & blocks
+) const
+{
+	float score(0.);
+	for ( std::vector< BlockStep >::const_iterator block( blocks.begin() ); block != blocks.end(); ++block ) {
+		score += blockweights_[ block->weights + ( seq.codes( start + block->offset ) & block->mask ) ];
+		if ( score + block->bestcase > cutoff ) return false;
+	}
+	return true;
+}
+
+unsigned
+WindowScorer::screen(
+	PackedSequence const & seq,
+	uint64_t first,
+	float cutoff,
+	std::vector< BlockStep > const & blocks
+) const
+{
+#ifdef WINDOWSCORER_X86
+	if ( avx2_ ) return screen8_avx2( seq, first, cutoff, &blocks[0], blocks.size(), &blockweights_[0] );
+#endif
+	unsigned alive(0);
+	for ( unsigned i(0); i < width; ++i ) {
+		if ( screen_scalar( seq, first+i, cutoff, blocks ) ) alive |= 1 << i;
+	}
+	return alive;
+}
+
+//// gathers the even bits of x into its low half
+static inline uint64_t
+even_bits( uint64_t x )
+{
+	x &= 0x5555555555555555ULL;
+	x = ( x | ( x >> 1 ) ) & 0x3333333333333333ULL;
+	x = ( x | ( x >> 2 ) ) & 0x0F0F0F0F0F0F0F0FULL;
+	x = ( x | ( x >> 4 ) ) & 0x00FF00FF00FF00FFULL;
+	x = ( x | ( x >> 8 ) ) & 0x0000FFFF0000FFFFULL;
+	return ( x | ( x >> 16 ) ) & 0x00000000FFFFFFFFULL;
+}
+
+//// base i is bit i%64 of word i/64 of each plane: low and high bit of its 2-bit code, and its N flag
+//// (bases past the end of the sequence read as zero)
+void
+WindowScorer::planes(
+	PackedSequence const & seq,
+	uint64_t first,
+	std::vector< uint64_t > & lo,
+	std::vector< uint64_t > & hi,
+	std::vector< uint64_t > & n
+)
+{
+	for ( unsigned w(0); w < lo.size(); ++w ) {
+		uint64_t const b( first + 64*w );
+		uint64_t const codes0( b < seq.size() ? seq.codes(b) : 0 );
+		uint64_t const codes1( b + 32 < seq.size() ? seq.codes(b+32) : 0 );
+		lo[w] = even_bits( codes0 ) | ( even_bits( codes1 ) << 32 );
+		hi[w] = even_bits( codes0 >> 1 ) | ( even_bits( codes1 >> 1 ) << 32 );
+		n[w] = b < seq.size() ? seq.nbits(b) : 0;
+	}
+}
+
+//// bit-sliced counters, one bit of each of 64 windows per word: counting from 2^bits-1-budget, a
+//// window overflows (and stays rejected) on its budget+1th mismatch, and the group is dropped once
+//// all of its windows have
+template < unsigned Bits, typename MatchStep >
+static bool
+count_group(
+	std::vector< uint64_t > const & lo,
+	std::vector< uint64_t > const & hi,
+	std::vector< uint64_t > const & n,
+	unsigned first,
+	unsigned size,
+	uint64_t start,
+	std::vector< MatchStep > const & steps,
+	float * out
+)
+{
+	uint64_t const valid( size == 64 ? ~uint64_t(0) : ( uint64_t(1) << size ) - 1 );
+	uint64_t bits[ Bits ];
+	for ( unsigned i(0); i < Bits; ++i ) bits[i] = ( start >> i ) & 1 ? ~uint64_t(0) : 0;
+	uint64_t over( ~valid );
+	for ( typename std::vector< MatchStep >::const_iterator step( steps.begin() ); step != steps.end(); ++step ) {
+		unsigned const at( first + step->offset ), w( at >> 6 ), shift( at & 63 );
+		uint64_t l( lo[w] ), h( hi[w] ), nn( n[w] );
+		if ( shift ) {
+			l = ( l >> shift ) | ( lo[w+1] << ( 64 - shift ) );
+			h = ( h >> shift ) | ( hi[w+1] << ( 64 - shift ) );
+			nn = ( nn >> shift ) | ( n[w+1] << ( 64 - shift ) );
+		}
+		uint64_t carry( ~( ( step->matches[0] & ~h & ~l ) | ( step->matches[1] & ~h & l ) |
+		                   ( step->matches[2] & h & ~l ) | ( step->matches[3] & h & l ) ) | nn );
+		for ( unsigned i(0); i < Bits; ++i ) {
+			uint64_t const next( bits[i] & carry );
+			bits[i] ^= carry;
+			carry = next;
+		}
+		over |= carry;
+		if ( !~over ) return false;
+	}
+	return record_mismatches( bits, 1, Bits, over, start, steps.size(), out );
+}
+
+template < unsigned Bits, typename MatchStep >
+static bool
+count_windows(
+	std::vector< uint64_t > const & lo,
+	std::vector< uint64_t > const & hi,
+	std::vector< uint64_t > const & n,
+	unsigned count,
+	unsigned budget,
+	std::vector< MatchStep > const & steps,
+	bool avx2,
+	float * out
+)
+{
+	uint64_t const start( ( uint64_t(1) << Bits ) - 1 - budget );
+	bool left( false );
+	unsigned i(0);
+#ifdef WINDOWSCORER_X86
+	if ( avx2 ) {
+		uint64_t counter[ 4 * Bits ], over[4];
+		for ( ; i + 256 <= count; i += 256 ) {
+			count4_avx2< Bits >( &lo[ i >> 6 ], &hi[ i >> 6 ], &n[ i >> 6 ], start, &steps[0], steps.size(), counter, over );
+			for ( unsigned g(0); g < 4; ++g ) {
+				left |= record_mismatches( counter + g, 4, Bits, over[g], start, steps.size(), out + i + 64*g );
+			}
+		}
+	}
+#else
+	(void)avx2;
+#endif
+	for ( ; i < count; i += 64 ) {
+		left |= count_group< Bits >( lo, hi, n, i, std::min( 64u, count - i ), start, steps, out + i );
+	}
+	return left;
+}
+
+bool
+WindowScorer::count_mismatches(
+	std::vector< uint64_t > const & lo,
+	std::vector< uint64_t > const & hi,
+	std::vector< uint64_t > const & n,
+	unsigned count,
+	unsigned budget,
+	std::vector< MatchStep > const & steps,
+	float * out
+) const
+{
+	std::fill( out, out + count, rejected() );
+	// the fewest bits that count past the budget
+	if ( budget < 2 ) return count_windows< 1 >( lo, hi, n, count, budget, steps, avx2_, out );
+	else if ( budget < 4 ) return count_windows< 2 >( lo, hi, n, count, budget, steps, avx2_, out );
+	else if ( budget < 8 ) return count_windows< 3 >( lo, hi, n, count, budget, steps, avx2_, out );
+	else if ( budget < 16 ) return count_windows< 4 >( lo, hi, n, count, budget, steps, avx2_, out );
+	else if ( budget < 32 ) return count_windows< 5 >( lo, hi, n, count, budget, steps, avx2_, out );
+	else if ( budget < 64 ) return count_windows< 6 >( lo, hi, n, count, budget, steps, avx2_, out );
+	else if ( budget < 128 ) return count_windows< 7 >( lo, hi, n, count, budget, steps, avx2_, out );
+	else return count_windows< 8 >( lo, hi, n, count, budget, steps, avx2_, out );
+}
+
+//// a score at or below cutoff allows at most (number of consensus positions) + cutoff - (best score
+//// of the other positions) mismatches
+bool
+WindowScorer::score_consensus(
+	PackedSequence const & seq,
+	uint64_t first,
+	unsigned count,
+	float cutoff,
+	float * fwd,
+	float * rvs
+) const
+{
+	float const positions( fwdmatches_.size() );
+	float const allowed( std::min( cutoff + ( weighted_ ? slack_ - weightedbest_ : 0 ) + positions, positions ) );
+	if ( allowed < 0 ) {
+		std::fill( fwd, fwd + count, rejected() );
+		std::fill( rvs, rvs + count, rejected() );
+		return false;
+	}
+	// both strands are scored from the same planes
+	unsigned const words( ( count + length_ ) / 64 + 2 );
+	std::vector< uint64_t > lo( words ), hi( words ), n( words );
+	planes( seq, first, lo, hi, n );
+	bool const fwdleft( count_mismatches( lo, hi, n, count, unsigned( allowed ), fwdmatches_, fwd ) );
+	bool const rvsleft( count_mismatches( lo, hi, n, count, unsigned( allowed ), rvsmatches_, rvs ) );
+	if ( !weighted_ ) return fwdleft || rvsleft;
+	// (the mismatch counts of the rest are only partial scores)
+	for ( unsigned i(0); fwdleft && i < count; ++i ) {
+		if ( fwd[i] != rejected() ) score_scalar( seq, first+i, cutoff, fwdsteps_, fwd+i );
+	}
+	for ( unsigned i(0); rvsleft && i < count; ++i ) {
+		if ( rvs[i] != rejected() ) score_scalar( seq, first+i, cutoff, rvssteps_, rvs+i );
+	}
+	return fwdleft || rvsleft;
+}
+
+bool
+WindowScorer::score(
+	PackedSequence const & seq,
+	uint64_t first,
+	unsigned count,
+	float cutoff,
+	float * fwd,
+	float * rvs
+) const
+{
+	if ( consensus_ ) return score_consensus( seq, first, count, cutoff, fwd, rvs );
+	// screening is pointless until there is a cutoff to reject against
+	bool const screening( cutoff != rejected() && length_ > 0 );
+	float const screencutoff( cutoff + slack_ );
+
+	bool left( false );
+	unsigned i(0);
+	for ( ; i + width <= count; i += width ) {
+		bool const clean( screening && !seq.anyN( first+i, width + length_ - 1 ) );
+		bool const fwdalive( !clean || screen( seq, first+i, screencutoff, fwdblocks_ ) );
+		bool const rvsalive( !clean || screen( seq, first+i, screencutoff, rvsblocks_ ) );
+		if ( !fwdalive ) std::fill( fwd+i, fwd+i+width, rejected() );
+		if ( !rvsalive ) std::fill( rvs+i, rvs+i+width, rejected() );
+		left |= fwdalive || rvsalive;
+#ifdef WINDOWSCORER_X86
+		if ( avx2_ ) {
+			if ( fwdalive ) score8_avx2( seq, first+i, cutoff, &fwdsteps_[0], length_, fwd+i );
+			if ( rvsalive ) score8_avx2( seq, first+i, cutoff, &rvssteps_[0], length_, rvs+i );
+		} else {
+			if ( fwdalive ) {
+				score4_sse2( seq, first+i, cutoff, &fwdsteps_[0], length_, fwd+i );
+				score4_sse2( seq, first+i+4, cutoff, &fwdsteps_[0], length_, fwd+i+4 );
+			}
+			if ( rvsalive ) {
+				score4_sse2( seq, first+i, cutoff, &rvssteps_[0], length_, rvs+i );
+				score4_sse2( seq, first+i+4, cutoff, &rvssteps_[0], length_, rvs+i+4 );
+			}
+		}
+#else
+		for ( unsigned w(0); w < width; ++w ) {
+			if ( fwdalive ) score_scalar( seq, first+i+w, cutoff, fwdsteps_, fwd+i+w );
+			if ( rvsalive ) score_scalar( seq, first+i+w, cutoff, rvssteps_, rvs+i+w );
+		}
+#endif
+	}
+	// remainder
+	for ( ; i < count; ++i ) {
+		score_scalar( seq, first+i, cutoff, fwdsteps_, fwd+i );
+		score_scalar( seq, first+i, cutoff, rvssteps_, rvs+i );
+		left = true;
+	}
+	return left;
+}
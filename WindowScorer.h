@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_WindowScorer
+#define INCLUDED_WindowScorer
+
+#include <limits>
+#include <vector>
+
+#include "PSSM.h"
+#include "Sequence.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+/// scores many neighbouring windows of a packed sequence at once, on both strands
+/// positions are visited in PSSM priority order, with the same best-case early rejection as the
+/// scalar search; SIMD lanes are dropped together once none of them can beat the cutoff
+/// the reverse strand is scored over the same forward bases with the reverse-complemented matrix
+/// windows without N are first screened with the PSSM block tables, a few positions per lookup;
+/// only the windows this cannot reject are scored position by position
+/// matrices mostly of consensus positions (0/-1 weights, as in IUPAC target strings) are screened by
+/// counting mismatches at those positions instead, bit-parallel over 64 windows at a time; windows
+/// within budget are then scored as usual, unless the whole matrix is consensus
+class WindowScorer {
+
+	public:
+		WindowScorer() : length_(0), slack_(0.), avx2_(false), consensus_(false), weighted_(0), weightedbest_(0.) {}
+		WindowScorer( PSSM const & pssm );
+
+		// value stored for windows rejected early
+		static float rejected() { return std::numeric_limits< float >::infinity(); }
+
+		// number of windows scored per SIMD pass
+		static unsigned const width = 8;
+
+		// scores windows starting at [first, first+count) on both strands
+		// fwd and rvs receive count scores each; windows that cannot score <= cutoff are set to rejected()
+		// false if every window was rejected
+		bool
+		score(
+			PackedSequence const & seq,
+			uint64_t first,
+			unsigned count,
+			float cutoff,
+			float * fwd,
+			float * rvs
+		) const;
+
+		unsigned length() const { return length_; }
+		// largest difference float rounding can make between two orders of summing a window's weights
+		float slack() const { return slack_; }
+		// whether windows are screened by counting mismatches
+		bool consensus() const { return consensus_; }
+
+	private:
+		// one scoring step per PSSM position in priority order
+		struct Step {
+			unsigned offset; // offset of the base within the window
+			float weights[8]; // indexed by 2-bit base code, plus 4 for 'N'
+			float bestcase; // best additional score possible after this step
+		};
+
+		// one screening step per PSSM block in priority order
+		struct BlockStep {
+			unsigned offset; // offset of the first base within the window
+			unsigned mask; // selects the 2-bit codes of the block's bases
+			unsigned weights; // start of the block's table in blockweights_
+			float bestcase; // best additional score possible after this block
+		};
+
+		// one mismatch counting step per consensus position in priority order
+		struct MatchStep {
+			unsigned offset; // offset of the base within the window
+			uint64_t matches[4]; // all ones for the bases (A, C, G, T) that match, else zero
+		};
+
+		// the base bits of [first, first + 64*words.size()) as bit planes, one bit per base
+		static void planes( PackedSequence const & seq, uint64_t first, std::vector< uint64_t > & lo,
+		                    std::vector< uint64_t > & hi, std::vector< uint64_t > & n );
+		// scores the first count windows of the planes, rejecting those with more than budget mismatches
+		// false if all of them were rejected
+		bool count_mismatches( std::vector< uint64_t > const & lo, std::vector< uint64_t > const & hi,
+		                       std::vector< uint64_t > const & n, unsigned count, unsigned budget,
+		                       std::vector< MatchStep > const & steps, float * out ) const;
+		bool score_consensus( PackedSequence const & seq, uint64_t first, unsigned count, float cutoff,
+		                      float * fwd, float * rvs ) const;
+
+		void score_scalar( PackedSequence const & seq, uint64_t start, float cutoff,
+		                   std::vector< Step > const & steps, float * out ) const;
+		bool screen_scalar( PackedSequence const & seq, uint64_t start, float cutoff,
+		                    std::vector< BlockStep > const & blocks ) const;
+		// bit i set if window first+i survives screening
+		unsigned screen( PackedSequence const & seq, uint64_t first, float cutoff,
+		                 std::vector< BlockStep > const & blocks ) const;
+
+	private:
+		unsigned length_;
+		std::vector< Step > fwdsteps_, rvssteps_;
+		std::vector< BlockStep > fwdblocks_, rvsblocks_;
+		std::vector< float > blockweights_;
+		// block sums round differently from position sums: screening allows for this much error
+		float slack_;
+		bool avx2_; // runtime CPU support for the 8-wide kernel
+		bool consensus_;
+		std::vector< MatchStep > fwdmatches_, rvsmatches_;
+		unsigned weighted_; // number of other positions
+		float weightedbest_; // best score the other positions can add
+};
+
+#endif
@@ -0,0 +1,31 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Justin Ashworth 2007
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef INCLUDED_libpssm
+#define INCLUDED_libpssm
+
+// everything needed to embed the search (link with libpssm.a or libpssm.so, -pthread and -lz)
+//
+// sequences may be given in memory rather than as files, and results taken hit by hit rather than
+// printed; at the SILENT output level nothing at all is written to stdout or stderr:
+//
+//	GeneList genes( SILENT );
+//	genes.add( "chr1", bases, size ); // or genes.read_fasta( text, size )
+//	TargetSearch search( matrices, 50, false, false, SILENT );
+//	search.scan_genes( genes );
+//	CallbackSink sink( []( std::string const & matrix, std::string const & gene, uint64_t position,
+//	                       bool rvs, float score, std::string const & site ) { ... } );
+//	search.report_results( sink );
+//
+// nothing ends the program: problems come back to the caller instead, as TargetSearch::good() and
+// error() for matrices that cannot be loaded, GeneList::good() for files that cannot be read, and
+// false from the functions that read or write files
+
+#include "Hits.h"
+#include "PSSM.h"
+#include "Sequence.h"
+#include "TargetSearch.h"
+#include "SearchServer.h"
+
+#endif
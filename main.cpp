@@ -37,6 +37,7 @@
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <vector>
 #include <cstdlib> // exit, EXIT_FAILURE
 
 #include "util.h"
@@ -44,20 +45,39 @@
 #include "Hits.h"
 #include "PSSM.h"
 #include "TargetSearch.h"
+#include "SearchServer.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 void usage_error()
 {
 	std::cerr << "\n"
-	 << " -s|--seq|--sequence     sequencefile   : FASTA format\n"
+	 << " -s|--seq|--sequence     sequencefile   : FASTA format, plain or gzip/bgzip ('-' for stdin)\n"
 	 << " -l|--list               seqlistfile    : file with list of FASTA files\n"
-	 << " -p|--pssm               pssm           : weight matrix file or target string\n"
+	 << " -p|--pssm               pssm           : weight matrix file or target string (repeatable)\n"
+	 << " -P|--pssmlist           pssmlistfile   : file with list of matrix files or target strings\n"
 	 << " -t|--target                            : pssm is a simple target string [ACGT] (not a pssm file)\n"
 	 << " -inv                                   : invert weights (for positive weights)\n"
 	 << " -n|--numhits|--hits     #              : number of hits (20)\n"
+	 << " --max-score             #              : report every hit scoring at or below this\n"
+	 << " --pvalue                #              : report every hit with at most this p-value\n"
+	 << " --background            a c g t        : base composition for p-values (0.25 each)\n"
+	 << " --warm-start                           : sample the sequence for a cutoff before searching it\n"
+	 << " --suffix-array                         : search binary genome files by their suffix arrays\n"
+	 << " --seed                  #              : the same, seeded from the most informative # positions\n"
+	 << " --threads               #              : number of threads to read and search each file with (1)\n"
+	 << " --stream                               : search blocks as they are read (constant memory)\n"
+	 << " --prefetch              #              : number of files read ahead while searching (1)\n"
+	 << " --server                               : keep the sequences loaded and answer queries from stdin,\n"
+	 << "                                          one line of the options above per query\n"
+	 << " --socket                path           : the same, for clients of a Unix domain socket\n"
+	 << " --batch-window          ms             : server queries this close together share a pass (5)\n"
 	 << " -v|--verbose                           : more output\n"
 	 << " -m|--minimal|--mute                    : less output\n"
 	 << "example: [executable] -s genes.dna -p mso-xray.pssm\n"
+	 << "\n"
+	 << "[executable] index sequencefile genomefile [--suffix-array]\n"
+	 << "   writes a binary genome file, to be given as a sequencefile instead for faster loading\n"
+	 << "   (with a suffix array for --suffix-array searches)\n"
 	 << "\n";
 	exit(EXIT_FAILURE);
 }
@@ -67,43 +87,53 @@ int main( int argc, char *argv[] ) {
 
 	std::cout << std::endl;
 
-	std::string seqfilename, seqlistname, pssm;
-	unsigned numhits(20);
-	bool invert_pssm(false), simple_target(false);
-	OutputLevel outputlevel(NORMAL);
+	// convert a FASTA file to a binary genome file
+	if ( argc > 1 && std::string( argv[1] ) == "index" ) {
+		if ( argc != 4 && !( argc == 5 && std::string( argv[4] ) == "--suffix-array" ) ) usage_error();
+		GeneList genelist( argv[2] );
+		if ( !genelist.good() || ( argc == 5 && !genelist.build_suffixes() ) ) exit(EXIT_FAILURE);
+		if ( !genelist.write_index( argv[3] ) ) exit(EXIT_FAILURE);
+		return 0;
+	}
+
+	std::string seqfilename, seqlistname, socketname;
+	bool stream(false), server(false);
+	unsigned batchwindow(5), prefetch(1);
+	SearchOptions options;
+	std::vector< std::string > const args( argv, argv + argc );
 
 	// parse command line arguments
-	for ( int i(1); i < argc; ++i ) {
+	for ( unsigned i(1); i < args.size(); ++i ) {
 
-		std::string arg( argv[i] );
+		std::string const & arg( args[i] );
 
-		if ( arg == "-s" || arg == "--seq" || arg == "--sequence" ) {
-			if ( ++i >= argc ) usage_error();
-			seqfilename = argv[i];
+		if ( options.parse( args, i ) ) {
+			if ( options.bad ) usage_error();
 
-		} else if ( arg == "-l" || arg == "--list" ) {
-			if ( ++i >= argc ) usage_error();
-			seqlistname = argv[i];
+		} else if ( arg == "-s" || arg == "--seq" || arg == "--sequence" ) {
+			if ( ++i >= args.size() ) usage_error();
+			seqfilename = args[i];
 
-		} else if ( arg == "-p" || arg == "--pssm" ) {
-			if ( ++i >= argc ) usage_error();
-			pssm = argv[i];
+		} else if ( arg == "-l" || arg == "--list" ) {
+			if ( ++i >= args.size() ) usage_error();
+			seqlistname = args[i];
 
-		} else if ( arg == "-t" || arg == "--target" ) {
-			simple_target = true;
+		} else if ( arg == "--stream" ) {
+			stream = true;
 
-		} else if ( arg == "-n" || arg == "--numhits" || arg == "--hits" ) {
-			if ( ++i >= argc ) usage_error();
-			numhits = atoi( argv[i] );
+		} else if ( arg == "--prefetch" ) {
+			if ( ++i >= args.size() || !read_unsigned( args[i], prefetch ) ) usage_error();
 
-		} else if ( arg == "-inv" ) {
-			invert_pssm = true;
+		} else if ( arg == "--server" ) {
+			server = true;
 
-		} else if ( arg == "-v" || arg == "--verbose" ) {
-			outputlevel = VERBOSE;
+		} else if ( arg == "--socket" ) {
+			if ( ++i >= args.size() ) usage_error();
+			socketname = args[i];
+			server = true;
 
-		} else if ( arg == "-m" || arg == "--minimal" || arg == "--mute" ) {
-			outputlevel = MINIMAL;
+		} else if ( arg == "--batch-window" ) {
+			if ( ++i >= args.size() || !read_unsigned( args[i], batchwindow ) ) usage_error();
 
 		} else if ( arg == "-h" || arg == "--help" ) {
 			usage_error();
@@ -136,6 +166,8 @@ int main( int argc, char *argv[] ) {
 		struct dirent *dirp;
 		while ( ( dirp = readdir(dp) ) ) {
 			std::string name( dirp->d_name );
+			// (compressed files by the extension under .gz)
+			if ( name.size() > 3 && name.compare( name.size() - 3, 3, ".gz" ) == 0 ) name.erase( name.size() - 3 );
 			unsigned const l( name.size() );
 			// check file extension
 			unsigned i(l-1);
@@ -151,12 +183,30 @@ int main( int argc, char *argv[] ) {
 		closedir(dp);
 	}
 
-	TargetSearch search( pssm, numhits, simple_target, invert_pssm, outputlevel );
-	// perform the search, operates as a functor over gene files
-	for ( std::list< std::string >::const_iterator name( filenames.begin() );
-	      name != filenames.end(); ++name ) {
-		search.scan_seq( *name );
+	// keep the sequences loaded and answer queries
+	if ( server ) {
+		SearchServer searchserver( filenames, options.outputlevel );
+		searchserver.batchwindow( batchwindow );
+		if ( socketname.empty() ) searchserver.serve_stdin();
+		else if ( !searchserver.serve_socket( socketname ) ) exit(EXIT_FAILURE);
+		return 0;
 	}
+
+	std::vector< std::string > pssms;
+	if ( !options.matrices( pssms ) ) {
+		std::cerr << "ERROR: couldn't open " << options.pssmlistname << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	TargetSearch search( pssms, options.maxhits(), options.simple_target, options.invert_pssm, options.outputlevel );
+	if ( !search.good() ) exit(EXIT_FAILURE);
+	options.configure( search );
+	search.prefetch( prefetch );
+	// perform the search, operates as a functor over gene files
+	if ( stream ) {
+		for ( std::list< std::string >::const_iterator name( filenames.begin() );
+		      name != filenames.end(); ++name ) {
+			search.scan_stream( *name );
+		}
+	} else search.scan_files( std::vector< std::string >( filenames.begin(), filenames.end() ) );
 	search.print_results();
 }
-
@@ -0,0 +1,53 @@
+#!/bin/sh
+# regression tests, run from the top directory by 'make test'
+# each test writes its inputs to a scratch directory and compares the program's output
+
+EXE=${EXE:-./pssm++.linux}
+SCRATCH=$(mktemp -d) || exit 1
+trap 'rm -rf "$SCRATCH"' EXIT
+failures=0
+
+check() {
+	if [ "$2" = 0 ]; then echo "ok   $1"; else echo "FAIL $1"; failures=$((failures+1)); fi
+}
+
+# the results of a search, from the summary line on
+results() {
+	sed -n '/basepairs searched/,$p'
+}
+
+#### --stream: a record of exactly one block (2^24 bases) ends with its carried tail, whose windows
+#### are searched by the shorter of two matrices
+awk 'BEGIN { srand(7); print ">exact"; line = ""
+	for ( i = 0; i < 16777216; ++i ) {
+		if ( i == 16777200 ) { line = line "GATTACAGATTACA"; i += 13 }
+		else line = line substr( "ACGT", int( rand() * 4 ) + 1, 1 )
+		if ( length( line ) == 60 ) { print line; line = "" }
+	}
+	if ( line != "" ) print line }' > "$SCRATCH/exact.fa"
+set -- -s "$SCRATCH/exact.fa" -t -p GATTACAGATTACA -p ACGTACGTACGTACGTACGTACGT -n 3 -m
+"$EXE" "$@" 2>/dev/null | results > "$SCRATCH/loaded"
+"$EXE" "$@" --stream 2>/dev/null | results > "$SCRATCH/streamed"
+grep -q '^-14.00 GATTACAGATTACA .* 16777200$' "$SCRATCH/streamed" && cmp -s "$SCRATCH/loaded" "$SCRATCH/streamed"
+check "stream record ending on a block boundary" $?
+
+#### --server: cutoff values are parsed per query; bad ones get an ERROR line and the server goes on
+printf '>small\nCCCCCCCCCCGATTACAGATTACACCCCCCCCCC\n' > "$SCRATCH/small.fa"
+printf '%s\n' \
+	"-t -p GATTACAGATTACA --pvalue abc" \
+	"-t -p GATTACAGATTACA --pvalue 0" \
+	"-t -p GATTACAGATTACA --pvalue 2" \
+	"-t -p GATTACAGATTACA --max-score -14x" \
+	"-t -p GATTACAGATTACA --background 1 1 1 -1" \
+	"-t -p GATTACAGATTACA --background 0 0 0 0" \
+	"-t -p GATTACAGATTACA --max-score -14" \
+	"-t -p GATTACAGATTACA --pvalue 1e-8 --background 1 1 1 1" \
+	quit | "$EXE" -s "$SCRATCH/small.fa" --server -m 2>/dev/null > "$SCRATCH/server"
+[ "$(grep -c '^ERROR: bad value for' "$SCRATCH/server")" = 6 ] &&
+	[ "$(grep -c '^-14.00 GATTACAGATTACA >small 10$' "$SCRATCH/server")" = 2 ] &&
+	[ "$(grep -c '^//$' "$SCRATCH/server")" = 8 ]
+check "server queries with bad cutoff values" $?
+
+echo
+if [ $failures -ne 0 ]; then echo "$failures test(s) failed"; exit 1; fi
+echo "all tests passed"
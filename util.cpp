@@ -2,8 +2,12 @@
 // Justin Ashworth 2007
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#include <cctype> // isspace
+#include <cmath> // std::isfinite
+#include <cstdlib> // strtod
 #include <iostream>
-#include <cstdlib> // exit, EXIT_FAILURE
+#include <limits>
+#include <stdint.h> // uint64_t
 
 #include "util.h"
 
@@ -86,115 +90,79 @@ std::list<char> degen(char letter){
 		degen.push_back('G');
 		degen.push_back('T');
 	}
-	else std::cerr << "Warning: letter " << letter << " not recognized" << std::endl;
 	return(degen);
 }
 
-bool isnuc( char letter )
+////////////////////////////////////////////////////////////////////////////////
+// the tables are filled in by constexpr functions of the byte value (C++11 constexpr functions
+// cannot loop, so the table initializers spell out all 256 calls)
+
+// to[i] for the first from[i] that is letter, else otherwise
+constexpr char translate( char const * from, char const * to, unsigned letter, char otherwise )
 {
-	switch( letter ) {
-		case 'A': return true;
-		case 'C': return true;
-		case 'G': return true;
-		case 'T': return true;
-		case 'a': return true;
-		case 'c': return true;
-		case 'g': return true;
-		case 't': return true;
-		case 'N': return true;
-		case 'n': return true;
-	}
-	return false;
+	return !*from ? otherwise
+	     : (unsigned char)*from == letter ? *to
+	     : translate( from + 1, to + 1, letter, otherwise );
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// probably faster than toupper
-char upper( char nucleotide )
+constexpr unsigned char nucleotide_class( unsigned letter )
 {
-	switch( nucleotide ) {
-		case 'a': return 'A';
-		case 'c': return 'C';
-		case 'g': return 'G';
-		case 't': return 'T';
-		case 'A': return 'A';
-		case 'C': return 'C';
-		case 'G': return 'G';
-		case 'T': return 'T';
-		case 'R': return 'R';
-		case 'Y': return 'Y';
-		case 'M': return 'M';
-		case 'K': return 'K';
-		case 'S': return 'S';
-		case 'W': return 'W';
-		case 'B': return 'B';
-		case 'D': return 'D';
-		case 'H': return 'H';
-		case 'V': return 'V';
-		case 'N': return 'N';
-		case 'n': return 'N';
-	}
-	std::cerr << "Bad nucleotide " << nucleotide << std::endl;
-	exit(EXIT_FAILURE);
-	return toupper( nucleotide );
+	return translate( "ACGTacgtNn \t\n\v\f\r", "0123012344555555", letter, '6' ) - '0';
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// probably faster than tolower
-char lower( char nucleotide )
+constexpr char upper_letter( unsigned letter )
 {
-	switch( nucleotide ) {
-		case 'a': return 'a';
-		case 'c': return 'c';
-		case 'g': return 'g';
-		case 't': return 't';
-		case 'A': return 'a';
-		case 'C': return 'c';
-		case 'G': return 'g';
-		case 'T': return 't';
-		case 'R': return 'r';
-		case 'Y': return 'y';
-		case 'M': return 'm';
-		case 'K': return 'k';
-		case 'S': return 's';
-		case 'W': return 'w';
-		case 'B': return 'b';
-		case 'D': return 'd';
-		case 'H': return 'h';
-		case 'V': return 'v';
-		case 'N': return 'n';
-	}
-	std::cerr << "Bad nucleotide " << nucleotide << std::endl;
-	exit(EXIT_FAILURE);
-	return tolower( nucleotide );
+	return translate( "acgtnACGTRYMKSWBDHVN", "ACGTNACGTRYMKSWBDHVN", letter, 0 );
+}
+
+constexpr char lower_letter( unsigned letter )
+{
+	return translate( "acgtACGTRYMKSWBDHVN", "acgtacgtrymkswbdhvn", letter, 0 );
 }
 
+constexpr char complement_letter( unsigned letter )
+{
+	return translate( "ACGTacgtRYSWKMBDHVN", "TGCAtgcaYRWSMKVHDBN", letter, 0 );
+}
+
+#define TABLE4( f, i ) f( (i) ), f( (i)+1 ), f( (i)+2 ), f( (i)+3 )
+#define TABLE16( f, i ) TABLE4( f, (i) ), TABLE4( f, (i)+4 ), TABLE4( f, (i)+8 ), TABLE4( f, (i)+12 )
+#define TABLE64( f, i ) TABLE16( f, (i) ), TABLE16( f, (i)+16 ), TABLE16( f, (i)+32 ), TABLE16( f, (i)+48 )
+#define TABLE256( f ) TABLE64( f, 0 ), TABLE64( f, 64 ), TABLE64( f, 128 ), TABLE64( f, 192 )
+
+extern constexpr unsigned char nucleotide_classes[256] = { TABLE256( nucleotide_class ) };
+extern constexpr char upper_letters[256] = { TABLE256( upper_letter ) };
+extern constexpr char lower_letters[256] = { TABLE256( lower_letter ) };
+extern constexpr char complement_letters[256] = { TABLE256( complement_letter ) };
+
+#undef TABLE4
+#undef TABLE16
+#undef TABLE64
+#undef TABLE256
+
 ////////////////////////////////////////////////////////////////////////////////
-char comp( char nucleotide )
+bool read_unsigned( std::string const & text, unsigned & value )
 {
-	switch( nucleotide ) {
-		case 'A': return 'T';
-		case 'C': return 'G';
-		case 'G': return 'C';
-		case 'T': return 'A';
-		case 'a': return 't';
-		case 'c': return 'g';
-		case 'g': return 'c';
-		case 't': return 'a';
-  	case 'R': return 'Y';
-  	case 'Y': return 'R';
-  	case 'S': return 'W';
-  	case 'W': return 'S';
-  	case 'K': return 'M';
-  	case 'M': return 'K';
-  	case 'B': return 'V';
-  	case 'D': return 'H';
-  	case 'H': return 'D';
-  	case 'V': return 'B';
-		case 'N': return 'N';
+	if ( text.empty() || text.size() > 10 ) return false;
+	uint64_t number(0);
+	for ( std::string::const_iterator c( text.begin() ); c != text.end(); ++c ) {
+		if ( *c < '0' || *c > '9' ) return false;
+		number = 10 * number + ( *c - '0' );
 	}
-	std::cerr << "No complement for bad nucleotide " << nucleotide << std::endl;
-	exit(EXIT_FAILURE);
-	return 'x';
+	if ( number > std::numeric_limits< unsigned >::max() ) return false;
+	value = number;
+	return true;
+}
+
+bool read_double( std::string const & text, double & value )
+{
+	// (strtod would skip leading whitespace)
+	if ( text.empty() || isspace( (unsigned char)text[0] ) ) return false;
+	char * end(0);
+	double const number( strtod( text.c_str(), &end ) );
+	if ( *end != '\0' || !std::isfinite( number ) ) return false;
+	value = number;
+	return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -6,10 +6,12 @@
 #define INCLUDED_util
 
 #include <iosfwd>
+#include <string>
 #include <vector>
 #include <list>
 
 enum OutputLevel {
+	SILENT, // nothing at all (for use as a library)
 	MINIMAL,
 	NORMAL,
 	VERBOSE
@@ -22,11 +24,31 @@ std::ostream & operator << (
 
 std::list<char> nucleotides();
 std::list<char> base_codes();
+// the bases an (upper-case IUPAC) code letter stands for; empty for anything else
 std::list<char> degen(char);
-bool isnuc(char);
-char upper(char);
-char lower(char);
-char comp(char);
+
+// translation tables over all 256 byte values, built at compile time
+// nucleotide classes: 0-3 for A, C, G, T (either case), 4 for N or n, 5 for whitespace, 6 otherwise
+enum { NUC_N = 4, NUC_SPACE = 5, NUC_OTHER = 6 };
+extern unsigned char const nucleotide_classes[256];
+// the letter translated, or 0 where there is no translation
+extern char const upper_letters[256];
+extern char const lower_letters[256];
+extern char const complement_letters[256];
+
+inline bool isnuc( char letter ) { return nucleotide_classes[ (unsigned char)letter ] < NUC_SPACE; }
+
+// upper- and lower-case versions and complements of (IUPAC) nucleotide letters, or 0 for anything
+// else (callers check letters from input before translating them)
+inline char upper( char nucleotide ) { return upper_letters[ (unsigned char)nucleotide ]; }
+inline char lower( char nucleotide ) { return lower_letters[ (unsigned char)nucleotide ]; }
+inline char comp( char nucleotide ) { return complement_letters[ (unsigned char)nucleotide ]; }
+
+// a whole decimal number that fits an unsigned (false for anything else: signs, other characters,
+// overflow)
+bool read_unsigned( std::string const & text, unsigned & value );
+// the same for a finite real number, in any form strtod reads (false if anything follows it)
+bool read_double( std::string const & text, double & value );
 
 bool secondfloatdesc(
 	std::pair< unsigned, float > const & p1,